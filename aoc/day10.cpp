@@ -2,58 +2,138 @@
 #include "harness.h"
 
 #include <ranges>
+#include <thread>
 
-int64_t getCorruptionScore(const string& line)
+// ---- table-driven validator ----
+// every character is looked up in a 256-entry class table which says whether it opens or closes, and which pair it
+// belongs to. the stack only ever holds pair indices, so matching a closer is one compare and both scores fall out
+// of the same parse. the pairs and their scores are given at runtime and baked into the tables once, so any other
+// delimiter grammar runs through exactly the same loop
+
+static constexpr uint8_t kBracketOpen = 0x40;
+static constexpr uint8_t kBracketClose = 0x80;
+static constexpr uint8_t kBracketPairMask = 0x3f;
+static constexpr size_t kFixedBracketDepth = 1024;     // lines nesting deeper than this spill onto the heap
+
+struct BracketPair
 {
-    vector<char> stack;
-    stack.reserve(500);
+    char open, close;
+    int64_t corruptionScore;
+    int64_t completionScore;
+};
 
-    for (char c : line)
+class BracketGrammar
+{
+    array<uint8_t, 256> m_classes{};
+    vector<char> m_closers;
+    vector<int64_t> m_corruptionScores;
+    vector<int64_t> m_completionScores;
+    int64_t m_completionBase;
+
+public:
+    BracketGrammar(const vector<BracketPair>& pairs, int64_t completionBase = 5) : m_completionBase(completionBase)
     {
-        switch (c)
+        if (pairs.size() > kBracketPairMask + 1)
+            throw "too many bracket pairs";
+        if (completionBase < 1)
+            throw "completion base must be at least 1";
+
+        for (const BracketPair& pair : pairs)
         {
-        case '{': case '[': case '<': case '(':
-            stack.push_back(c);
-            break;
+            uint8_t& openClass = m_classes[uint8_t(pair.open)];
+            uint8_t& closeClass = m_classes[uint8_t(pair.close)];
+            if (openClass || closeClass || pair.open == pair.close)
+                throw "bracket used twice";
+            if (pair.completionScore < 0)
+                throw "completion scores can't be negative";
 
-        case ')':
-            if (stack.empty())
-                return 0;
-            if (stack.back() != '(')
-                return 3;
-            stack.pop_back();
-            break;
+            uint8_t ix = uint8_t(m_closers.size());
+            openClass = kBracketOpen | ix;
+            closeClass = kBracketClose | ix;
+            m_closers.push_back(pair.close);
+            m_corruptionScores.push_back(pair.corruptionScore);
+            m_completionScores.push_back(pair.completionScore);
+        }
+    }
 
-        case '}':
-            if (stack.empty())
-                return 0;
-            if (stack.back() != '{')
-                return 1197;
-            stack.pop_back();
-            break;
+    uint8_t classify(char c) const { return m_classes[uint8_t(c)]; }
+    char closer(uint8_t pair) const { return m_closers[pair]; }
+    int64_t corruptionScore(uint8_t pair) const { return m_corruptionScores[pair]; }
+    int64_t completionScore(uint8_t pair) const { return m_completionScores[pair]; }
+    int64_t completionBase() const { return m_completionBase; }
+};
 
-        case ']':
-            if (stack.empty())
-                return 0;
-            if (stack.back() != '[')
-                return 57;
-            stack.pop_back();
-            break;
+static const BracketGrammar kAocBrackets({
+    { '(', ')', 3, 1 },
+    { '[', ']', 57, 2 },
+    { '{', '}', 1197, 3 },
+    { '<', '>', 25137, 4 },
+});
 
-        case '>':
-            if (stack.empty())
-                return 0;
-            if (stack.back() != '<')
-                return 25137;
-            stack.pop_back();
-            break;
 
-        default:
+struct BracketScore
+{
+    int64_t corruption = 0;     // score of the first bad closer, if there is one
+    int64_t completion = 0;     // autocomplete score if the line is merely incomplete
+};
+
+BracketScore validateBrackets(string_view line, const BracketGrammar& grammar = kAocBrackets)
+{
+    uint8_t fixedStack[kFixedBracketDepth];
+    vector<uint8_t> deepStack;
+    uint8_t* stack = fixedStack;
+    size_t capacity = kFixedBracketDepth;
+    size_t depth = 0;
+
+    for (char c : line)
+    {
+        uint8_t cls = grammar.classify(c);
+        uint8_t pair = cls & kBracketPairMask;
+        if (cls & kBracketOpen)
+        {
+            if (depth == capacity)
+            {
+                deepStack.resize(capacity * 2);
+                if (stack == fixedStack)
+                    copy(fixedStack, fixedStack + depth, begin(deepStack));
+                stack = deepStack.data();
+                capacity = deepStack.size();
+            }
+            stack[depth++] = pair;
+        }
+        else if (cls & kBracketClose)
+        {
+            if (depth == 0)
+                return {};
+            if (stack[--depth] != pair)
+                return { grammar.corruptionScore(pair), 0 };
+        }
+        else
+        {
             throw "nope";
         }
     }
 
-    return 0;
+    // base^depth gets big fast: with the aoc scores anything past 27 unclosed brackets won't fit
+    BracketScore score;
+    while (depth > 0)
+    {
+        const int64_t value = grammar.completionScore(stack[--depth]);
+        if (score.completion > (INT64_MAX - value) / grammar.completionBase())
+            throw "completion score overflows int64";
+        score.completion = score.completion * grammar.completionBase() + value;
+    }
+    return score;
+}
+
+int64_t getCorruptionScore(const string& line)
+{
+    return validateBrackets(line).corruption;
+}
+
+int64_t autoComplete(const string& line)
+{
+    return validateBrackets(line).completion;
 }
 
 
@@ -66,87 +146,178 @@ int64_t day10(const stringlist& input)
     return corruption;
 }
 
-int64_t autoComplete(const string& line)
+int64_t day10_2(const stringlist& input)
 {
-    vector<char> stack;
-    stack.reserve(500);
-    for (char c : line)
+    vector<int64_t> scores;
+    for (auto& line : input)
     {
-        switch (c)
-        {
-        case '{': case '[': case '<': case '(':
-            stack.push_back(c);
-            break;
+        int64_t score = autoComplete(line);
+        if (score > 0)
+            scores.push_back(score);
+    }
 
-        case ')':
-            if (stack.empty() || stack.back() != '(')
-                return 0;
-            stack.pop_back();
-            break;
+    size_t midpointIx = scores.size() / 2;
+    auto midpointIt = begin(scores) + midpointIx;
+    ranges::nth_element(scores, midpointIt);
 
-        case '}':
-            if (stack.empty() || stack.back() != '{')
-                return 0;
-            stack.pop_back();
-            break;
+    return *midpointIt;
+}
 
-        case ']':
-            if (stack.empty() || stack.back() != '[')
-                return 0;
-            stack.pop_back();
-            break;
 
-        case '>':
-            if (stack.empty() || stack.back() != '<')
-                return 0;
-            stack.pop_back();
-            break;
+// ---- batches ----
+// each thread validates a band of lines into its own totals and completion list; the lists are only joined up at
+// the end so there's exactly one nth_element over all the completion scores
 
-        default:
-            throw "nope";
+struct BracketBatch
+{
+    int64_t corruption = 0;
+    int64_t middleCompletion = 0;
+};
+
+BracketBatch validateBatch(const stringlist& lines, unsigned numThreads = thread::hardware_concurrency(),
+    const BracketGrammar& grammar = kAocBrackets)
+{
+    numThreads = clamp(numThreads, 1u, max(unsigned(lines.size()), 1u));
+
+    vector<int64_t> corruptions(numThreads, 0);
+    vector<vector<int64_t>> completions(numThreads);
+    auto validateBand = [&](unsigned band)
+    {
+        size_t first = lines.size() * band / numThreads;
+        size_t last = lines.size() * (band + 1) / numThreads;
+        for (size_t i = first; i < last; ++i)
+        {
+            BracketScore score = validateBrackets(lines[i], grammar);
+            corruptions[band] += score.corruption;
+            if (score.completion > 0)
+                completions[band].push_back(score.completion);
         }
+    };
+
+    parallelFor(numThreads, validateBand);     // rethrows a bad line's error once everyone's done
+
+    BracketBatch result;
+    vector<int64_t> scores;
+    for (unsigned band = 0; band < numThreads; ++band)
+    {
+        result.corruption += corruptions[band];
+        scores.insert(end(scores), begin(completions[band]), end(completions[band]));
     }
 
-    int64_t completionScore = 0;
-    for (char c : stack | views::reverse)
+    if (!scores.empty())
     {
-        completionScore *= 5;
+        auto midpointIt = begin(scores) + scores.size() / 2;
+        ranges::nth_element(scores, midpointIt);
+        result.middleCompletion = *midpointIt;
+    }
+    return result;
+}
+
 
-        switch (c)
+// ---- giant lines ----
+// bracket matching is associative: any stretch of a line reduces to some closers it couldn't match followed by some
+// openers that were never closed. so a huge line can be cut into chunks which are reduced in parallel, then the
+// residues are merged left to right -- each chunk's leading closers pop the openers left over from the chunks before
+
+struct BracketResidue
+{
+    vector<pair<size_t, uint8_t>> closers;  // unmatched closers in order: where they are, and their pair
+    vector<uint8_t> openers;                // unmatched openers, bottom of the stack first
+    size_t stopAt = string_view::npos;      // where this chunk hit a mismatch or a character that isn't a bracket
+    bool invalid = false;
+};
+
+struct BracketMatch
+{
+    size_t corruptAt = string_view::npos;   // first closer that doesn't match. a stray closer stops here too, but scores 0
+    int64_t corruption = 0;
+    string completion;                      // the closers that would finish the line, if nothing stopped it
+};
+
+BracketResidue reduceBrackets(string_view chunk, size_t offset, const BracketGrammar& grammar)
+{
+    BracketResidue residue;
+    for (size_t i = 0; i < chunk.size(); ++i)
+    {
+        uint8_t cls = grammar.classify(chunk[i]);
+        uint8_t pair = cls & kBracketPairMask;
+        if (cls & kBracketOpen)
         {
-        case '(':
-            completionScore += 1;
-            break;
-        case '[':
-            completionScore += 2;
-            break;
-        case '{':
-            completionScore += 3;
-            break;
-        case '<':
-            completionScore += 4;
+            residue.openers.push_back(pair);
+        }
+        else if (cls & kBracketClose)
+        {
+            if (residue.openers.empty())
+            {
+                residue.closers.emplace_back(offset + i, pair);
+            }
+            else if (residue.openers.back() != pair)
+            {
+                residue.stopAt = offset + i;
+                break;
+            }
+            else
+            {
+                residue.openers.pop_back();
+            }
+        }
+        else
+        {
+            residue.stopAt = offset + i;
+            residue.invalid = true;
             break;
         }
     }
-    return completionScore;
+    return residue;
 }
 
-
-int64_t day10_2(const stringlist& input)
+BracketMatch matchLongLine(string_view line, unsigned numThreads = thread::hardware_concurrency(),
+    const BracketGrammar& grammar = kAocBrackets)
 {
-    vector<int64_t> scores;
-    for (auto& line : input)
+    numThreads = clamp(numThreads, 1u, max(unsigned(line.size()), 1u));
+
+    vector<BracketResidue> residues(numThreads);
+    auto reduceChunk = [&](unsigned chunk)
     {
-        int64_t score = autoComplete(line);
-        if (score > 0)
-            scores.push_back(score);
-    }
+        size_t first = line.size() * chunk / numThreads;
+        size_t last = line.size() * (chunk + 1) / numThreads;
+        residues[chunk] = reduceBrackets(line.substr(first, last - first), first, grammar);
+    };
 
-    size_t midpointIx = scores.size() / 2;
-    auto midpointIt = begin(scores) + midpointIx;
-    ranges::nth_element(scores, midpointIt);
+    parallelFor(numThreads, reduceChunk);
 
-    return *midpointIt;
+    BracketMatch result;
+    vector<uint8_t> stack;
+    for (BracketResidue& residue : residues)
+    {
+        for (auto [pos, pair] : residue.closers)
+        {
+            if (stack.empty() || stack.back() != pair)
+            {
+                result.corruptAt = pos;
+                result.corruption = stack.empty() ? 0 : grammar.corruptionScore(pair);
+                return result;
+            }
+            stack.pop_back();
+        }
+
+        if (residue.invalid)
+            throw "nope";
+
+        if (residue.stopAt != string_view::npos)
+        {
+            result.corruptAt = residue.stopAt;
+            result.corruption = grammar.corruptionScore(grammar.classify(line[residue.stopAt]) & kBracketPairMask);
+            return result;
+        }
+
+        stack.insert(end(stack), begin(residue.openers), end(residue.openers));
+    }
+
+    result.completion.reserve(stack.size());
+    for (uint8_t pair : stack | views::reverse)
+        result.completion.push_back(grammar.closer(pair));
+    return result;
 }
 
 
@@ -170,5 +341,44 @@ R"([({(<(())[]>[[{[]{<()<>>
     test(288957, autoComplete("[({(<(())[]>[[{[]{<()<>>"));
     test(5566, autoComplete("[(()[<>])]({[<{<<[]>>("));
     test(288957, day10_2(READ(sample)));
+    test(288957, validateBatch(READ(sample), 3).middleCompletion);
+    test(26397, validateBatch(READ(sample), 4).corruption);
+
+    test(string("}}]])})]"), matchLongLine("[({(<(())[]>[[{[]{<()<>>", 4).completion);
+    test(size_t(12), matchLongLine("{([(<{}[<>[]}>{[]{[(<()>", 3).corruptAt);
+    test(1197ll, matchLongLine("{([(<{}[<>[]}>{[]{[(<()>", 7).corruption);
+
+    string giant;
+    for (int i = 0; i < 1000000; ++i)
+        giant += "([{<";
+    for (int i = 0; i < 1000000; ++i)
+        giant += ">}])";
+    test(string(), matchLongLine(giant).completion);
+    test(string_view::npos, matchLongLine(giant).corruptAt);
+    giant[6000001] = ')';
+    test(size_t(6000001), matchLongLine(giant, 6).corruptAt);
+    test(3ll, matchLongLine(giant, 6).corruption);
+    giant.resize(5000000);
+    test(size_t(3000000), matchLongLine(giant).completion.size());
+
+    BracketGrammar slashes({ { '/', '\\', 10, 1 }, { 'b', 'd', 100, 2 }, { 'p', 'q', 1000, 3 } }, 4);
+    test(1000ll, validateBrackets("/p/\\bq", slashes).corruption);
+    test((3ll * 4 + 2) * 4 + 1, validateBrackets("/bp/\\", slashes).completion);
+    test(string("q\\"), matchLongLine("/pqpb/\\d", 3, slashes).completion);
+    test(size_t(5), matchLongLine("/pqpbqb/\\d", 3, slashes).corruptAt);
+
+    test(57ll, validateBrackets(string(5000, '(') + "()]").corruption);
+    test(7450580596923828124ll, validateBrackets(string(27, '<')).completion);    // 5^27 - 1
+    string overflowError;
+    try { validateBrackets(string(28, '<')); } catch (const char* error) { overflowError = error; }
+    test(string("completion score overflows int64"), overflowError);
+    stringlist crlf = READ(sample);
+    crlf[3] += '\r';     // an incomplete line, so validating gets as far as the \r
+    string batchError;
+    try { validateBatch(crlf, 4); } catch (const char* error) { batchError = error; }
+    test(string("nope"), batchError);
+
+    test(3404870164, validateBatch(LOAD(10)).middleCompletion);
+    test(266301, validateBatch(LOAD(10), 5).corruption);
     gogogo(day10_2(LOAD(10)));
 }
\ No newline at end of file
@@ -1,105 +1,191 @@
 #include "pch.h"
 #include "harness.h"
 
+#include <bit>
+#include <immintrin.h>
+#include <random>
 
+
+// the grid is stored as energy levels with a one cell border all round, so every octopus has 8 neighbours and the
+// flash loop needs no bounds checks. the border holds kBorder, which is far enough from kFlash that no amount of
+// nudging in one tick will make it flash; it's put back at the end of every tick.
+//
+// a cell only flashes on the increment that takes it to exactly kFlash, so the flash list doubles as the work queue
+// (no "flashed" bitmap) and as the list of cells to reset to 0 afterwards (no second pass over the grid)
+//
+// optionally it keeps a hash of the whole grid up to date as it goes. it's the sum of key(cell) * energy(cell), so
+// the everybody-gains-one step just adds the sum of all the keys, each flash nudge adds its neighbour's key, and
+// resetting a flasher subtracts its key times whatever it had built up to
 class Octopodes
 {
-    using Cell = int8_t;
-    using Index = uint16_t;
+public:
+    using Cell = uint8_t;
+    using Index = uint32_t;
+
+private:
+    static constexpr Cell kFlash = 10;
+    static constexpr Cell kBorder = 0x80;
+
     vector<Cell> m_cells;
+    vector<Index> m_flashes;        // scratch, kept between ticks so it's only allocated once
+    array<int32_t, 8> m_neighbours;
 
     Index m_width;
     Index m_height;
+    Index m_stride;
+
+    bool m_hashing = false;
+    uint64_t m_hash = 0;
+    uint64_t m_keySum = 0;
+
+    static uint64_t cellKey(Index ix)
+    {
+        uint64_t key = (ix + 1) * 0x9e3779b97f4a7c15ull;
+        key = (key ^ (key >> 32)) * 0xd6e8feb86659fd93ull;
+        return key ^ (key >> 32);
+    }
+
+    void resetBorder();
+    template<bool Hashing> int tickImpl();
 
 public:
     Octopodes(const stringlist& input)
     {
         m_width = (Index)input.front().length();
         m_height = (Index)input.size();
+        m_stride = m_width + 2;
 
-        m_cells.reserve(m_width * m_height);
-
-        auto back = back_inserter(m_cells);
+        m_cells.assign(size_t(m_stride) * (m_height + 2), kBorder);
+        Cell* row = m_cells.data() + m_stride + 1;
         for (const string& line : input)
-            ranges::copy(line, back);
+        {
+            ranges::transform(line, row, [](char c) { return Cell(c - '0'); });
+            row += m_stride;
+        }
+
+        const int32_t stride = int32_t(m_stride);
+        m_neighbours = { -stride - 1, -stride, -stride + 1, -1, 1, stride - 1, stride, stride + 1 };
     }
 
     uint32_t getWidth() const { return m_width; }
     uint32_t getHeight() const { return m_height; }
 
-    int tick();
+    int tick() { return m_hashing ? tickImpl<true>() : tickImpl<false>(); }
+
+    void enableHashing();
+    uint64_t getHash() const { return m_hash; }
+    const vector<Cell>& getCells() const { return m_cells; }
 
     friend ostream& operator<<(ostream&, const Octopodes&);
 };
 
-int Octopodes::tick()
+void Octopodes::resetBorder()
 {
-    vector<Index> willflash;
-    willflash.reserve(100);
-    ranges::for_each(m_cells, [&](Cell& c)
-        {
-            ++c;
-            if (c == '9' + 1)
-                willflash.push_back(Index(&c - m_cells.data()));
-        });
+    Cell* cells = m_cells.data();
+    const size_t lastRow = size_t(m_stride) * (m_height + 1);
+    fill_n(cells, m_stride, kBorder);
+    fill_n(cells + lastRow, m_stride, kBorder);
+    for (size_t row = m_stride; row < lastRow; row += m_stride)
+    {
+        cells[row] = kBorder;
+        cells[row + m_stride - 1] = kBorder;
+    }
+}
 
-    vector<bool> flashed(m_cells.size(), false);
-    while (!willflash.empty())
+void Octopodes::enableHashing()
+{
+    m_hashing = true;
+    m_hash = 0;
+    m_keySum = 0;
+    for (Index ix = 0; ix < Index(m_cells.size()); ++ix)
     {
-        Index ixFlash = willflash.back();
-        willflash.pop_back();
-        if (flashed[ixFlash])
-            continue;
+        m_hash += cellKey(ix) * m_cells[ix];
+        m_keySum += cellKey(ix);
+    }
+}
 
-        int fy = ixFlash / m_width;
-        int fx = ixFlash - (fy * m_width);
+template<bool Hashing>
+int Octopodes::tickImpl()
+{
+    // everyone flashes at most once, plus a little slack so the candidate write below never needs checking
+    if (m_flashes.size() < m_cells.size() + 8)
+        m_flashes.resize(m_cells.size() + 8);
+    Index* flashes = m_flashes.data();
+    size_t numFlashes = 0;
 
-        flashed[ixFlash] = true;
+    // everyone gains one energy, 32 at a time, noting who hit the threshold
+    Cell* cells = m_cells.data();
+    const Index numCells = Index(m_cells.size());
+    Index ix = 0;
+    if (cpuFeatures().avx2)
+    {
+        const __m256i one = _mm256_set1_epi8(1);
+        const __m256i flash = _mm256_set1_epi8(kFlash);
+        for (; ix + 32 <= numCells; ix += 32)
+        {
+            __m256i energy = _mm256_add_epi8(_mm256_loadu_si256((const __m256i*)(cells + ix)), one);
+            _mm256_storeu_si256((__m256i*)(cells + ix), energy);
+
+            uint32_t flashMask = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(energy, flash)));
+            for (; flashMask; flashMask &= flashMask - 1)
+                flashes[numFlashes++] = ix + countr_zero(flashMask);
+        }
+    }
+    for (; ix < numCells; ++ix)     // the tail, or everyone without avx2
+    {
+        if (++cells[ix] == kFlash)
+            flashes[numFlashes++] = ix;
+    }
 
-        for (int y = max(fy-1, 0); y < min(fy+2, int(m_height)); ++y)
+    // the flash list grows as we walk it. whether a neighbour tips over is a coin toss, so rather than branch on it
+    // we always write it down and only keep it if it did
+    for (size_t flashIx = 0; flashIx < numFlashes; ++flashIx)
+    {
+        const Index flasher = flashes[flashIx];
+        for (int32_t offset : m_neighbours)
         {
-            for (int x = max(fx - 1, 0); x < min(fx+2, int(m_width)); ++x)
-            {
-                if (x == fx && y == fy)
-                    continue;
-
-                Index ix = Index(x + y * m_width);
-                Cell newOc = ++m_cells[ix];
-                if (newOc == '9' + 1 && !flashed[ix])
-                    willflash.push_back(ix);
-            }
+            const Index neighbour = flasher + offset;
+            flashes[numFlashes] = neighbour;
+            numFlashes += (++cells[neighbour] == kFlash);
+            if constexpr (Hashing)
+                m_hash += cellKey(neighbour);
         }
     }
 
-    int numflashes = 0;
-    for (Index y = 0; y < m_height; ++y)
+    if constexpr (Hashing)
     {
-        for (Index x = 0; x < m_width; ++x)
+        m_hash += m_keySum;
+        for (size_t flashIx = 0; flashIx < numFlashes; ++flashIx)
+            m_hash -= cellKey(flashes[flashIx]) * cells[flashes[flashIx]];
+
+        // the border's drift has to come back out before it's put back
+        const Index lastRow = m_stride * (m_height + 1);
+        for (Index x = 0; x < m_stride; ++x)
+        {
+            m_hash -= cellKey(x) * Cell(cells[x] - kBorder);
+            m_hash -= cellKey(lastRow + x) * Cell(cells[lastRow + x] - kBorder);
+        }
+        for (Index row = m_stride; row < lastRow; row += m_stride)
         {
-            Index ix = x + y * m_width;
-            if (flashed[ix])
-            {
-                m_cells[ix] = '0';
-                ++numflashes;
-            }
+            m_hash -= cellKey(row) * Cell(cells[row] - kBorder);
+            m_hash -= cellKey(row + m_stride - 1) * Cell(cells[row + m_stride - 1] - kBorder);
         }
     }
 
-    return numflashes;
+    for (size_t flashIx = 0; flashIx < numFlashes; ++flashIx)
+        cells[flashes[flashIx]] = 0;
+    resetBorder();
+
+    return int(numFlashes);
 }
 
 ostream& operator<<(ostream& os, const Octopodes& oct)
 {
-    const Octopodes::Cell* curr = oct.m_cells.data();
-    for (size_t y = 0; y < oct.getHeight(); ++y)
+    const Octopodes::Cell* row = oct.m_cells.data() + oct.m_stride + 1;
+    for (size_t y = 0; y < oct.getHeight(); ++y, row += oct.m_stride)
     {
-        for (size_t x = 0; x < oct.getWidth(); ++x, ++curr)
-        {
-            if (*curr > 0)
-                os << *curr;
-            else
-                os << '.';
-        }
+        for (size_t x = 0; x < oct.getWidth(); ++x)
+            os << char('0' + row[x]);
         os << '\n';
     }
     return os;
@@ -119,18 +205,125 @@ int day11(const stringlist& input, int numticks = 100)
     return totalticks;
 }
 
-int day11_2(const stringlist& input)
+
+// ---- cycles ----
+// the grid is deterministic, so once any state comes round again it'll loop forever. brent's algorithm finds the
+// loop's length with just one saved copy of the grid: the hash is compared every tick and the grids only when the
+// hashes match. then a second run with two grids a loop apart finds where it starts, and only that run's flash counts
+// are kept -- so the timeline holds the lead-in plus one loop, however long the search took. once we know the loop,
+// flashes after any number of ticks are just a lookup and some multiplication
+
+struct OctopusTimeline
 {
-    Octopodes ocs(input);
+    vector<int64_t> totalFlashes{ 0 };  // totalFlashes[t] is how many flashes there were in the first t ticks
+    int64_t firstSync = -1;             // first tick where everyone flashed together, or -1 if it hasn't yet
+    int64_t cycleLength = 0;            // the last state recorded repeats every cycleLength ticks. 0 if we gave up
+
+    int64_t numTicks() const { return int64_t(totalFlashes.size()) - 1; }
+
+    // -1 means it never happens, which we only know once the cycle's been found
+    int64_t syncTick() const
+    {
+        if (firstSync < 0 && cycleLength == 0)
+            throw "gave up before finding a sync or a cycle";
+        return firstSync;
+    }
 
+    int64_t flashesAfter(int64_t ticks) const
+    {
+        if (ticks <= numTicks())
+            return totalFlashes[ticks];
+        if (cycleLength == 0)
+            throw "didn't find a cycle";
+
+        const int64_t cycleStart = numTicks() - cycleLength;
+        const int64_t perCycle = totalFlashes.back() - totalFlashes[cycleStart];
+        const int64_t cycles = (ticks - numTicks()) / cycleLength;
+        const int64_t rest = (ticks - numTicks()) % cycleLength;
+        return totalFlashes.back() + cycles * perCycle + (totalFlashes[cycleStart + rest] - totalFlashes[cycleStart]);
+    }
+};
+
+OctopusTimeline traceOctopodes(const stringlist& input, int64_t maxTicks = 10'000'000)
+{
+    Octopodes ocs(input);
+    ocs.enableHashing();
     const int all = ocs.getWidth() * ocs.getHeight();
-    for (int tick = 1; ; ++tick)
+
+    OctopusTimeline timeline;
+    vector<Octopodes::Cell> saved = ocs.getCells();
+    uint64_t savedHash = ocs.getHash();
+    int64_t power = 1;
+    int64_t lambda = 0;
+    for (int64_t tick = 1; tick <= maxTicks; ++tick)
     {
-        if (ocs.tick() == all)
-            return tick;
+        if (lambda == power)
+        {
+            saved = ocs.getCells();
+            savedHash = ocs.getHash();
+            power *= 2;
+            lambda = 0;
+        }
+
+        int flashes = ocs.tick();
+        if (flashes == all && timeline.firstSync < 0)
+            timeline.firstSync = tick;      // the first sync is always before the lead-in + one loop, if there is one
+
+        ++lambda;
+        if (ocs.getHash() == savedHash && ocs.getCells() == saved)
+        {
+            timeline.cycleLength = lambda;
+            break;
+        }
+    }
+    if (timeline.cycleLength == 0)
+        return timeline;
+
+    // the hare starts a loop ahead, and the first tick it matches the tortoise is where the loop starts. the hare
+    // sees every tick up to there plus one loop, which is exactly the part of the timeline we need
+    Octopodes tortoise(input), hare(input);
+    tortoise.enableHashing();
+    hare.enableHashing();
+    timeline.totalFlashes.reserve(size_t(lambda) + 1);
+    for (int64_t tick = 0; tick < lambda; ++tick)
+        timeline.totalFlashes.push_back(timeline.totalFlashes.back() + hare.tick());
+    while (hare.getHash() != tortoise.getHash() || hare.getCells() != tortoise.getCells())
+    {
+        tortoise.tick();
+        timeline.totalFlashes.push_back(timeline.totalFlashes.back() + hare.tick());
+    }
+    return timeline;
+}
+
+
+int day11_2(const stringlist& input)
+{
+    return int(traceOctopodes(input).syncTick());
+}
+
+
+// the default is a quick smoke run. benchOctopodes(4096, 2000) is the size the simulator was built for, but it takes
+// a couple of minutes, so that one's only ever called by hand
+void benchOctopodes(uint32_t size = 512, int numTicks = 200)
+{
+    mt19937 rng(11);
+    uniform_int_distribution<int> digit('0', '9');
+    stringlist grid;
+    for (uint32_t y = 0; y < size; ++y)
+    {
+        grid.emplace_back(size, '0');
+        ranges::generate(grid.back(), [&]() { return char(digit(rng)); });
     }
 
-    return -1;
+    Octopodes ocs(grid);
+    int64_t flashes = 0;
+    {
+        cout << "day11 " << size << "x" << size << ", " << numTicks << " ticks: ";
+        ScopeTimer timer("octopodes");
+        for (int tick = 0; tick < numTicks; ++tick)
+            flashes += ocs.tick();
+    }
+    cout << "  " << flashes << " flashes" << endl;
 }
 
 
@@ -152,8 +345,25 @@ R"(5483143223
     test(35, day11(READ(sample), 2));
     test(204, day11(READ(sample), 10));
     test(1656, day11(READ(sample), 100));
+    test(1613, day11(LOAD(11)));
+    nD(benchOctopodes());
     gogogo(day11(LOAD(11)));
 
     test(195, day11_2(READ(sample)));
+    auto sampleTimeline = traceOctopodes(READ(sample));
+    test(10ll, sampleTimeline.cycleLength);
+    test(195ll + 10, sampleTimeline.numTicks());        // just the lead-in and one loop are kept
+    test(1656ll, sampleTimeline.flashesAfter(100));
+    test(int64_t(day11(READ(sample), 1000)), sampleTimeline.flashesAfter(1000));
+    test(3125 + 100 * ((1'000'000'000ll - 195) / 10), sampleTimeline.flashesAfter(1'000'000'000));
+    string neverSyncs = "48\n33\n11\n92\n89\n63\n30\n21\n26\n03\n64\n36";
+    auto neverSyncsTimeline = traceOctopodes(READ(neverSyncs));
+    test(-1ll, neverSyncsTimeline.syncTick());
+    string syncError;
+    try { traceOctopodes(READ(neverSyncs), 10).syncTick(); } catch (const char* error) { syncError = error; }
+    test(string("gave up before finding a sync or a cycle"), syncError);
+    test(32ll, neverSyncsTimeline.cycleLength);
+    test(int64_t(day11(READ(neverSyncs), 5000)), neverSyncsTimeline.flashesAfter(5000));
+    test(int64_t(day11(LOAD(11), 2345)), traceOctopodes(LOAD(11)).flashesAfter(2345));
     gogogo(day11_2(LOAD(11)));
 }
\ No newline at end of file
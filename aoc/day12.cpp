@@ -1,6 +1,11 @@
 #include "pch.h"
 #include "harness.h"
 
+#include <atomic>
+#include <mutex>
+#include <span>
+#include <thread>
+
 struct Cave
 {
     string name;
@@ -8,6 +13,7 @@ struct Cave
     uint8_t numNearby = 0;
     bool isBig;
     int8_t visitCount = 0;
+    int index = -1;         // dense, so per-walker state can live in a plain array
 
     Cave(const string& n) : name(n), isBig(isupper(n[0])) { /**/ }
 };
@@ -24,7 +30,9 @@ CaveSystem loadCaveSystem(const stringlist& input)
         if (itCave != caves.end())
             return;
 
-        caves.emplace(name, make_unique<Cave>(name));
+        auto cave = make_unique<Cave>(name);
+        cave->index = int(caves.size());
+        caves.emplace(name, move(cave));
     };
 
     for (auto& line : input)
@@ -62,7 +70,7 @@ ostream& operator<<(ostream& os, const CavePath& path)
     return os;
 }
 
-int day12(const stringlist& input, bool allowDoubleVisit = false)
+int day12_walk(const stringlist& input, bool allowDoubleVisit = false)
 {
     auto caves = loadCaveSystem(input);
 
@@ -134,6 +142,299 @@ int day12(const stringlist& input, bool allowDoubleVisit = false)
 }
 
 
+// ---- parallel walking ----
+// for when we actually want the paths rather than just how many there are. the first few levels of the search are
+// expanded up front into a pile of partial paths, then each thread keeps grabbing the next one and walks everything
+// below it. every walker has its own visit counts so nothing in the shared caves is touched
+
+struct CaveWalker
+{
+    const Cave* start;
+    const Cave* end;
+    CavePath path;
+    vector<int8_t> visits;
+    const Cave* doubleVisitCave;
+
+    bool canEnter(const Cave* cave) const
+    {
+        if (cave == start)
+            return false;
+        return cave->isBig || visits[cave->index] == 0 || !doubleVisitCave;
+    }
+
+    void enter(Cave* cave)
+    {
+        if (!cave->isBig && visits[cave->index]++ > 0)
+            doubleVisitCave = cave;
+        path.emplace_back(cave, -1);
+    }
+
+    void leave()
+    {
+        Cave* cave = path.back().first;
+        path.pop_back();
+        if (!cave->isBig && --visits[cave->index] > 0)
+            doubleVisitCave = nullptr;
+    }
+
+    template<typename OnPath>
+    int64_t walk(OnPath& onPath)
+    {
+        Cave* cave = path.back().first;
+        if (cave == end)
+        {
+            onPath(path);
+            return 1;
+        }
+
+        int64_t numPaths = 0;
+        for (Cave* next : cave->nearby)
+        {
+            if (!canEnter(next))
+                continue;
+
+            enter(next);
+            numPaths += walk(onPath);
+            leave();
+        }
+        return numPaths;
+    }
+};
+
+// onPath gets called with each complete path from whichever thread found it, so it needs to be thread safe
+template<typename OnPath>
+int64_t walkCavePaths(const CaveSystem& caves, bool allowDoubleVisit, OnPath&& onPath,
+    unsigned numThreads = thread::hardware_concurrency())
+{
+    numThreads = max(numThreads, 1u);
+
+    Cave* const start = caves.find("start")->second.get();
+    Cave* const end = caves.find("end")->second.get();
+
+    CaveWalker first{ start, end, {}, vector<int8_t>(caves.size(), 0), allowDoubleVisit ? nullptr : start };
+    first.enter(start);
+
+    // split until there's plenty to share round, or we've gone deep enough that it's not worth it
+    static const int MaxSplitLevels = 4;
+    const size_t wantedTasks = numThreads * 16;
+    int64_t totalPaths = 0;
+    vector<CaveWalker> tasks{ first };
+    for (int level = 0; level < MaxSplitLevels && tasks.size() < wantedTasks; ++level)
+    {
+        vector<CaveWalker> deeper;
+        for (CaveWalker& task : tasks)
+        {
+            if (task.path.back().first == end)
+                continue;
+
+            for (Cave* next : task.path.back().first->nearby)
+            {
+                if (!task.canEnter(next))
+                    continue;
+
+                CaveWalker& child = deeper.emplace_back(task);
+                child.enter(next);
+                if (next == end)
+                {
+                    onPath(child.path);
+                    ++totalPaths;
+                    deeper.pop_back();
+                }
+            }
+        }
+        tasks = move(deeper);
+    }
+
+    atomic<size_t> nextTask = 0;
+    vector<int64_t> threadPaths(numThreads, 0);
+    auto worker = [&](unsigned threadIx)
+    {
+        for (size_t taskIx = nextTask++; taskIx < tasks.size(); taskIx = nextTask++)
+            threadPaths[threadIx] += tasks[taskIx].walk(onPath);
+    };
+
+    parallelFor(numThreads, worker);
+
+    for (int64_t paths : threadPaths)
+        totalPaths += paths;
+    return totalPaths;
+}
+
+int64_t day12_parallel(const stringlist& input, bool allowDoubleVisit = false, unsigned numThreads = thread::hardware_concurrency())
+{
+    auto caves = loadCaveSystem(input);
+    return walkCavePaths(caves, allowDoubleVisit, [](const CavePath&) {}, numThreads);
+}
+
+
+// ---- compact caves ----
+// names are only needed while loading, so every cave is interned to a small int with the small caves first -- a small
+// cave's id is then also its bit in a visited mask. big caves never need remembering (you can always go back through
+// them) so they're contracted away: each pair of small caves either side of a big one gets an edge, and the edge's
+// weight says how many different ways there are to step between them. what's left is a CSR array over small caves
+
+struct CaveEdge
+{
+    uint8_t to;
+    uint32_t weight;
+};
+
+struct CompactCaves
+{
+    vector<string> names;
+    int numSmall = 0;
+    int start = -1;
+    int end = -1;
+    vector<uint32_t> firstEdge;     // edges out of cave i are edges[firstEdge[i]] up to edges[firstEdge[i+1]]
+    vector<CaveEdge> edges;
+
+    span<const CaveEdge> edgesFrom(int cave) const
+    {
+        return { edges.data() + firstEdge[cave], edges.data() + firstEdge[cave + 1] };
+    }
+};
+
+CompactCaves loadCompactCaves(const stringlist& input)
+{
+    vector<pair<string, string>> links;
+    for (auto& line : input)
+    {
+        auto ends = split(line, "-");
+        links.emplace_back(ends[0], ends[1]);
+    }
+
+    CompactCaves caves;
+    unordered_map<string, int> ids;
+    auto intern = [&](bool wantBig)
+    {
+        for (auto& [from, to] : links)
+        {
+            for (const string* name : { &from, &to })
+            {
+                if (bool(isupper((*name)[0])) == wantBig && ids.emplace(*name, int(caves.names.size())).second)
+                    caves.names.push_back(*name);
+            }
+        }
+    };
+    intern(false);
+    caves.numSmall = int(caves.names.size());
+    intern(true);
+
+    if (caves.numSmall > 64)
+        throw "too many small caves";
+    caves.start = ids.at("start");
+    caves.end = ids.at("end");
+
+    const int numSmall = caves.numSmall;
+    vector<uint32_t> weights(numSmall * numSmall, 0);
+    vector<vector<int>> smallNearBig(caves.names.size());
+    for (auto& [fromName, toName] : links)
+    {
+        int from = ids[fromName];
+        int to = ids[toName];
+        if (from < numSmall && to < numSmall)
+        {
+            weights[from * numSmall + to]++;
+            weights[to * numSmall + from]++;
+        }
+        else if (from < numSmall)
+        {
+            smallNearBig[to].push_back(from);
+        }
+        else if (to < numSmall)
+        {
+            smallNearBig[from].push_back(to);
+        }
+        else
+        {
+            throw "two big caves next to each other go round forever";
+        }
+    }
+
+    for (auto& nearby : smallNearBig)
+    {
+        for (int from : nearby)
+        {
+            for (int to : nearby)
+                weights[from * numSmall + to]++;
+        }
+    }
+
+    // nothing ever goes back into the start, and nothing leaves the end
+    caves.firstEdge.reserve(numSmall + 1);
+    for (int from = 0; from < numSmall; ++from)
+    {
+        caves.firstEdge.push_back(uint32_t(caves.edges.size()));
+        if (from == caves.end)
+            continue;
+
+        for (int to = 0; to < numSmall; ++to)
+        {
+            uint32_t weight = weights[from * numSmall + to];
+            if (weight > 0 && to != caves.start)
+                caves.edges.push_back({ uint8_t(to), weight });
+        }
+    }
+    caves.firstEdge.push_back(uint32_t(caves.edges.size()));
+
+    return caves;
+}
+
+
+// ---- counting ----
+// how many ways there are to get from here to the end only depends on where we are, which small caves we've already
+// used up and whether we've had our double visit yet -- not on how we got here. so rather than walk every path we
+// count them, remembering the answer for each of those states
+
+class CavePathCounter
+{
+    const CompactCaves& m_caves;
+    vector<unordered_map<uint64_t, int64_t>> m_memo;    // by cave * 2 + doubleUsed, then visited mask
+
+public:
+    CavePathCounter(const CompactCaves& caves) : m_caves(caves), m_memo(caves.numSmall * 2)
+    { /**/ }
+
+    int64_t countFrom(int cave, uint64_t visited, bool doubleUsed);
+
+    int64_t count(bool allowDoubleVisit)
+    {
+        return countFrom(m_caves.start, 1ull << m_caves.start, !allowDoubleVisit);
+    }
+};
+
+int64_t CavePathCounter::countFrom(int cave, uint64_t visited, bool doubleUsed)
+{
+    if (cave == m_caves.end)
+        return 1;
+
+    auto& memo = m_memo[cave * 2 + doubleUsed];
+    auto itKnown = memo.find(visited);
+    if (itKnown != memo.end())
+        return itKnown->second;
+
+    int64_t numPaths = 0;
+    for (const CaveEdge& edge : m_caves.edgesFrom(cave))
+    {
+        uint64_t bit = 1ull << edge.to;
+        if (!(visited & bit))
+            numPaths += edge.weight * countFrom(edge.to, visited | bit, doubleUsed);
+        else if (!doubleUsed)
+            numPaths += edge.weight * countFrom(edge.to, visited, true);
+    }
+
+    memo.emplace(visited, numPaths);
+    return numPaths;
+}
+
+
+int64_t day12(const stringlist& input, bool allowDoubleVisit = false)
+{
+    auto caves = loadCompactCaves(input);
+    return CavePathCounter(caves).count(allowDoubleVisit);
+}
+
+
 void run_day12()
 {
     string sample =
@@ -177,13 +478,46 @@ zg-he
 pj-fs
 start-RW)";
 
-    test(10, day12(READ(sample)));
-    test(19, day12(READ(sample2)));
-    test(226, day12(READ(sample3)));
-    gogogo(day12(LOAD(12)));
+    // a hub with a dozen dead ends off it: start, then any ordering of any subset of them, then end
+    stringlist hub = READ("start-HUB\nHUB-end");
+    for (int i = 0; i < 12; ++i)
+        hub.push_back("HUB-s" + to_string(i));
 
-    test(36, day12(READ(sample), true));
-    test(103, day12(READ(sample2), true));
-    test(3509, day12(READ(sample3), true));
-    gogogo(day12(LOAD(12), true));
+    test(10, day12_walk(READ(sample)));
+    test(19, day12_walk(READ(sample2)));
+    test(226, day12_walk(READ(sample3)));
+    test(10ll, day12(READ(sample)));
+    test(19ll, day12(READ(sample2)));
+    test(226ll, day12(READ(sample3)));
+    test(3510, day12_walk(LOAD(12)));
+    test(1302061345ll, day12(hub));
+    auto compactSample = loadCompactCaves(READ(sample));
+    test(5, compactSample.numSmall);
+    test(string("end"), compactSample.names[compactSample.end]);
+    test(size_t(11), compactSample.edges.size());
+    gogogo<int64_t>(day12(LOAD(12)), 3510);
+
+    test(36, day12_walk(READ(sample), true));
+    test(103, day12_walk(READ(sample2), true));
+    test(3509, day12_walk(READ(sample3), true));
+    test(36ll, day12(READ(sample), true));
+    test(103ll, day12(READ(sample2), true));
+    test(3509ll, day12(READ(sample3), true));
+    test(122880, day12_walk(LOAD(12), true));
+    test(122880ll, day12_parallel(LOAD(12), true));
+    test(3509ll, day12_parallel(READ(sample3), true, 3));
+
+    mutex pathsLock;
+    set<string> paths;
+    auto sampleCaves = loadCaveSystem(READ(sample));
+    walkCavePaths(sampleCaves, true, [&](const CavePath& path)
+        {
+            ostringstream os;
+            os << path;
+            lock_guard<mutex> lock(pathsLock);
+            paths.insert(os.str());
+        }, 5);
+    test(size_t(36), paths.size());
+    test(size_t(1), paths.count("start,A,c,A,b,A,c,A,end"));
+    gogogo<int64_t>(day12(LOAD(12), true), 122880);
 }
\ No newline at end of file
@@ -33,70 +33,173 @@ pair<vector<Pt2i16>, vector<Fold>> loadOrigami(const stringlist& input)
     return {points, folds};
 }
 
-int day13(const stringlist& input, int maxFolds=1)
+// ---- composed folds ----
+// a fold only ever moves points along one axis, and where a coordinate ends up depends on nothing but that coordinate.
+// so all the x folds together are just a lookup table from starting x to final x, and the same for y. composing them
+// back to front means each table is built over the (shrinking) sheet after the fold before it, then every point is
+// moved exactly once and lands on a sheet small enough to dedupe with a bitmap.
+// the fold line itself goes away with each fold; a dot on it or one that folds off the far edge maps to -1
+
+struct AxisRemap
 {
-    auto [points, folds] = loadOrigami(input);
+    vector<int16_t> to;     // final coordinate, by starting coordinate. -1 if it has nowhere to go
+    int finalSize;
+};
 
-    maxFolds = min(maxFolds, int(folds.size()));
-    for (int i=0; i<maxFolds; ++i)
+AxisRemap composeFolds(const vector<Fold>& folds, char axis, int size)
+{
+    vector<int> lines;
+    vector<int> sizes{ size };
+    for (const Fold& fold : folds)
     {
-        Pt::el_type* pval = &points.front().x;
-        if (folds[i].first == 'y')
-            ++pval;
+        if (fold.first != axis || fold.second >= sizes.back())
+            continue;
+
+        lines.push_back(fold.second);
+        sizes.push_back(fold.second);
+    }
 
-        auto fold = folds[i].second;
-        for ( ; pval < &points.back().y + 2; pval += 2)
+    AxisRemap remap{ vector<int16_t>(sizes.back()), sizes.back() };
+    iota(begin(remap.to), end(remap.to), int16_t(0));
+    for (int foldIx = int(lines.size()) - 1; foldIx >= 0; --foldIx)
+    {
+        const int line = lines[foldIx];
+        vector<int16_t> outer(sizes[foldIx]);
+        for (int v = 0; v < sizes[foldIx]; ++v)
         {
-            if (*pval > fold)
-                *pval = (2 * fold) - *pval;
+            int folded = (v > line) ? 2 * line - v : v;
+            outer[v] = (v == line || folded < 0) ? -1 : remap.to[folded];
         }
+        remap.to = move(outer);
     }
-
-    ranges::sort(points);
-    auto ded = ranges::unique(points);
-    return int(distance(points.begin(), ded.begin()));
+    return remap;
 }
 
-int day13_2(const stringlist& input)
+struct FoldedSheet
 {
-    auto [points, folds] = loadOrigami(input);
+    int width, height;
+    vector<uint64_t> dots;      // one bit per cell, row major
+    int numDots = 0;
 
-    for (const Fold& fold : folds)
+    FoldedSheet(int w, int h) : width(w), height(h), dots((size_t(w) * h + 63) / 64, 0) { /**/ }
+
+    bool at(int x, int y) const
     {
-        Pt::el_type* pval = &points.front().x;
-        if (fold.first == 'y')
-            ++pval;
+        size_t bit = size_t(y) * width + x;
+        return (dots[bit >> 6] >> (bit & 63)) & 1;
+    }
+};
 
-        auto foldLine = fold.second;
-        for (; pval < &points.back().y + 1; pval += 2)
-        {
-            if (*pval > foldLine)
-                *pval = (2 * foldLine) - *pval;
-        }
+FoldedSheet foldSheet(const vector<Pt>& points, const vector<Fold>& folds)
+{
+    int maxx = 0, maxy = 0;
+    for (const Pt& p : points)
+    {
+        maxx = max(maxx, int(p.x));
+        maxy = max(maxy, int(p.y));
     }
 
-    ranges::sort(points);
-    auto ded = ranges::unique(points);
-    points.erase(ded.begin(), ded.end());
+    const AxisRemap remapX = composeFolds(folds, 'x', maxx + 1);
+    const AxisRemap remapY = composeFolds(folds, 'y', maxy + 1);
 
-    int maxx = points.back().x; // points are sorted by x
-    auto itMaxy = ranges::max_element(points, {}, &Pt::y);
-    int maxy = itMaxy->y;
+    FoldedSheet sheet(remapX.finalSize, remapY.finalSize);
+    for (const Pt& p : points)
+    {
+        const int x = remapX.to[p.x];
+        const int y = remapY.to[p.y];
+        if (x < 0 || y < 0)
+            throw "dot on a fold line or folded off the sheet";
+
+        size_t bit = size_t(y) * sheet.width + x;
+        uint64_t& word = sheet.dots[bit >> 6];
+        uint64_t mask = 1ull << (bit & 63);
+        sheet.numDots += !(word & mask);
+        word |= mask;
+    }
+    return sheet;
+}
 
-    int width=maxx+1, height=maxy+1;
 
-    vector<char> screen(width*height, ' ');
-    for (const Pt& p : points)
-        screen[p.x + p.y*width] = '#';
+int day13(const stringlist& input, int maxFolds=1)
+{
+    auto [points, folds] = loadOrigami(input);
+
+    folds.resize(min(size_t(maxFolds), folds.size()));
+    return foldSheet(points, folds).numDots;
+}
+
+// ---- reading the letters ----
+// the folded sheet spells out capitals in a 4x6 dot font, one every 5 columns. each glyph is packed into 24 bits,
+// row by row, and looked up in the table of letters we've seen
 
-    for (int y=0; y<height; ++y)
+static constexpr int kGlyphWidth = 4;
+static constexpr int kGlyphHeight = 6;
+static constexpr int kGlyphPitch = kGlyphWidth + 1;
+
+constexpr uint32_t packGlyph(const char* dots)
+{
+    uint32_t bits = 0;
+    for (int i = 0; i < kGlyphWidth * kGlyphHeight; ++i)
+        bits |= uint32_t(dots[i] == '#') << i;
+    return bits;
+}
+
+static constexpr pair<uint32_t, char> kGlyphs[] = {
+    { packGlyph(".##." "#..#" "#..#" "####" "#..#" "#..#"), 'A' },
+    { packGlyph("###." "#..#" "###." "#..#" "#..#" "###."), 'B' },
+    { packGlyph(".##." "#..#" "#..." "#..." "#..#" ".##."), 'C' },
+    { packGlyph("####" "#..." "###." "#..." "#..." "####"), 'E' },
+    { packGlyph("####" "#..." "###." "#..." "#..." "#..."), 'F' },
+    { packGlyph(".##." "#..#" "#..." "#.##" "#..#" ".###"), 'G' },
+    { packGlyph("#..#" "#..#" "####" "#..#" "#..#" "#..#"), 'H' },
+    { packGlyph(".###" "..#." "..#." "..#." "..#." ".###"), 'I' },
+    { packGlyph("..##" "...#" "...#" "...#" "#..#" ".##."), 'J' },
+    { packGlyph("#..#" "#.#." "##.." "#.#." "#.#." "#..#"), 'K' },
+    { packGlyph("#..." "#..." "#..." "#..." "#..." "####"), 'L' },
+    { packGlyph(".##." "#..#" "#..#" "#..#" "#..#" ".##."), 'O' },
+    { packGlyph("###." "#..#" "#..#" "###." "#..." "#..."), 'P' },
+    { packGlyph("###." "#..#" "#..#" "###." "#.#." "#..#"), 'R' },
+    { packGlyph(".###" "#..." "#..." ".##." "...#" "###."), 'S' },
+    { packGlyph("#..#" "#..#" "#..#" "#..#" "#..#" ".##."), 'U' },
+    { packGlyph("#..." "#..." ".#.#" "..#." "..#." "..#."), 'Y' },     // Y's right arm is in the gap column
+    { packGlyph("####" "...#" "..#." ".#.." "#..." "####"), 'Z' },
+};
+
+// anything that isn't a letter we know comes out as '?'
+string readSheet(const FoldedSheet& sheet)
+{
+    string text;
+    for (int left = 0; left < sheet.width; left += kGlyphPitch)
     {
-        string_view line(screen.data() + y * width, width);
-        cout << DARK_RED << line << '\n';
+        uint32_t bits = 0;
+        for (int y = 0; y < min(sheet.height, kGlyphHeight); ++y)
+        {
+            for (int x = 0; x < kGlyphWidth && left + x < sheet.width; ++x)
+                bits |= uint32_t(sheet.at(left + x, y)) << (y * kGlyphWidth + x);
+        }
+
+        auto itGlyph = ranges::find(kGlyphs, bits, &pair<uint32_t, char>::first);
+        text.push_back(itGlyph != end(kGlyphs) ? itGlyph->second : '?');
     }
-    cout << RESET << endl;
+    return text;
+}
 
-    return 1337;
+ostream& operator<<(ostream& os, const FoldedSheet& sheet)
+{
+    for (int y = 0; y < sheet.height; ++y)
+    {
+        for (int x = 0; x < sheet.width; ++x)
+            os << (sheet.at(x, y) ? '#' : ' ');
+        os << '\n';
+    }
+    return os;
+}
+
+
+string day13_2(const stringlist& input)
+{
+    auto [points, folds] = loadOrigami(input);
+    return readSheet(foldSheet(points, folds));
 }
 
 
@@ -126,8 +229,14 @@ fold along y=7
 fold along x=5)";
 
     test(17, day13(READ(sample), 1));
+    test(16, day13(READ(sample), 2));
+    test(693, day13(LOAD(13), 1));
     gogogo(day13(LOAD(13), 1));
 
-    test(1337, day13_2(READ(sample)));
-    gogogo(day13_2(LOAD(13)));
+    test(string("?"), day13_2(READ(sample)));
+    stringlist glyphTest = READ("0,0\n3,0\n0,1\n3,1\n0,2\n3,2\n0,3\n3,3\n0,4\n3,4\n1,5\n2,5\n5,0\n5,1\n5,2\n5,3\n5,4\n5,5\n6,5\n7,5\n8,5");
+    test(string("UL"), day13_2(glyphTest));
+    stringlist iyTest = READ("1,0\n2,0\n3,0\n2,1\n2,2\n2,3\n2,4\n1,5\n2,5\n3,5\n5,0\n9,0\n5,1\n9,1\n6,2\n8,2\n7,3\n7,4\n7,5");
+    test(string("IY"), day13_2(iyTest));
+    gogogo(day13_2(LOAD(13)), string("UCLZRAZU"));
 }
\ No newline at end of file
@@ -1,93 +1,448 @@
 #include "pch.h"
 #include "harness.h"
 
-using PolyKey = uint16_t;
-using PolyRules = vector<pair<PolyKey, char>>;
-using Polymer = vector<char>;
-using PolyPairCount = unordered_map<PolyKey,int64_t>;
+#include <bit>
+#include <cmath>
 
-pair<Polymer,PolyRules> parsePolymers(const stringlist& input)
+// elements are interned to 0..k-1 as they turn up, so a pair is just a*k+b and the pair counts live in a dense k*k
+// array. each rule is boiled down to the two pair indices it produces; a pair with no rule produces itself, and its
+// second output goes to a bin slot on the end that's thrown away, so a step is a branch-free scatter
+//
+// a step is also a linear map on the pair counts, so for silly numbers of steps we raise its matrix to the power N by
+// repeated squaring instead, applying the step itself as the sparse scatter it is. nothing fits in an int64 by then,
+// so those counts are modulo something, with a log space run alongside to tell which element is actually most and
+// least common
+class PolymerEngine
 {
-    PolyRules rules;
-    rules.reserve(input.size() - 2);
-    for (auto itLine = input.begin() + 2; itLine != input.end(); ++itLine)
-    {
-        istringstream is(*itLine);
-        string keyStr;
-        char el;
-        is >> keyStr >> " -> " >> el;
-        PolyKey key = *reinterpret_cast<const PolyKey*>(keyStr.c_str());
-        rules.emplace_back(key, el);
+    array<int8_t, 256> m_elementIx;
+    string m_elements;
+    int m_numPairs = 0;
+    vector<int> m_left;         // by pair: the pair made from the left element and the inserted one
+    vector<int> m_right;        // ...and from the inserted one and the right. m_numPairs (the bin) if there's no rule
+    vector<int64_t> m_start;    // pair counts of the template, plus the bin
+    vector<int> m_polymer;      // the template itself
+    int m_last;                 // the last element never changes, and it's the only one that isn't first in a pair
+
+    int intern(char c)
+    {
+        int8_t& ix = m_elementIx[uint8_t(c)];
+        if (ix < 0)
+        {
+            ix = int8_t(m_elements.size());
+            m_elements.push_back(c);
+        }
+        return ix;
     }
 
-    ranges::sort(rules);
+    template<typename T>
+    vector<T> elementCounts(const vector<T>& pairCounts, T lastExtra) const
+    {
+        const int k = numElements();
+        vector<T> counts(k, T(0));
+        for (int pair = 0; pair < m_numPairs; ++pair)
+            counts[pair / k] += pairCounts[pair];
+        counts[m_last] += lastExtra;
+        return counts;
+    }
 
-    return {{input[0].begin(), input[0].end()}, rules};
+public:
+    PolymerEngine(const stringlist& input)
+    {
+        ranges::fill(m_elementIx, int8_t(-1));
+
+        const string& polymer = input[0];
+        vector<array<int, 3>> rules;
+        for (auto itLine = input.begin() + 2; itLine != input.end(); ++itLine)
+        {
+            if (itLine->size() < 7)
+                continue;
+            rules.push_back({ intern((*itLine)[0]), intern((*itLine)[1]), intern((*itLine)[6]) });
+        }
+        for (char c : polymer)
+            intern(c);
+
+        const int k = numElements();
+        m_numPairs = k * k;
+        m_left.resize(m_numPairs);
+        m_right.assign(m_numPairs, m_numPairs);
+        iota(begin(m_left), end(m_left), 0);
+        for (auto [a, b, inserted] : rules)
+        {
+            m_left[a * k + b] = a * k + inserted;
+            m_right[a * k + b] = inserted * k + b;
+        }
+
+        m_start.assign(m_numPairs + 1, 0);
+        for (size_t i = 0; i + 1 < polymer.size(); ++i)
+            m_start[m_elementIx[uint8_t(polymer[i])] * k + m_elementIx[uint8_t(polymer[i + 1])]]++;
+        m_last = m_elementIx[uint8_t(polymer.back())];
+        for (char c : polymer)
+            m_polymer.push_back(m_elementIx[uint8_t(c)]);
+    }
+
+    int numElements() const { return int(m_elements.size()); }
+    const string& getElements() const { return m_elements; }
+    const vector<int>& getPolymer() const { return m_polymer; }
+    int numPairs() const { return m_numPairs; }
+    int pairOf(int left, int right) const { return left * numElements() + right; }
+    int leftPair(int pair) const { return m_left[pair]; }
+    int rightPair(int pair) const { return m_right[pair]; }
+    bool hasRule(int pair) const { return m_right[pair] < m_numPairs; }
+    int insertion(int pair) const { return m_right[pair] / numElements(); }     // only if hasRule
+
+    // exact, so good until the polymer's length overflows (about 60 steps)
+    vector<int64_t> elementCountsAfter(int numSteps) const
+    {
+        vector<int64_t> counts = m_start, next(m_numPairs + 1);
+        for (int step = 0; step < numSteps; ++step)
+        {
+            ranges::fill(next, 0);
+            for (int pair = 0; pair < m_numPairs; ++pair)
+            {
+                next[m_left[pair]] += counts[pair];
+                next[m_right[pair]] += counts[pair];
+            }
+            counts.swap(next);
+        }
+        return elementCounts<int64_t>(counts, 1);
+    }
+
+    vector<uint64_t> elementCountsMod(int64_t numSteps, uint64_t modulus) const;
+    vector<double> elementLogCounts(int64_t numSteps) const;
+};
+
+// the step matrix, row vector convention: counts after = counts before * M
+template<typename T>
+using PolymerMatrix = vector<vector<T>>;
+
+// M^N, where M is the step described by left & right (right[pair] == n for the bin). works over any semiring: zero and
+// one are its identities, and mulAdd(acc, a, b) is acc + a*b in it
+//
+// M^N fills in however sparse M is, so the squarings have to be dense. but going through the bits from the top, the
+// only other multiply is by M itself, and each of its rows is just two pairs: (M * R)[pair] = R[left] + R[right]
+template<typename T, typename MulAdd>
+PolymerMatrix<T> polymerMatPow(const vector<int>& left, const vector<int>& right, int64_t numSteps, T zero, T one, MulAdd mulAdd)
+{
+    const size_t n = left.size();
+    PolymerMatrix<T> result(n, vector<T>(n, zero));
+    for (size_t i = 0; i < n; ++i)
+        result[i][i] = one;
+
+    auto square = [&](const PolymerMatrix<T>& a)
+    {
+        PolymerMatrix<T> out(n, vector<T>(n, zero));
+        for (size_t row = 0; row < n; ++row)
+        {
+            for (size_t mid = 0; mid < n; ++mid)
+            {
+                if (a[row][mid] == zero)
+                    continue;
+                for (size_t col = 0; col < n; ++col)
+                    out[row][col] = mulAdd(out[row][col], a[row][mid], a[mid][col]);
+            }
+        }
+        return out;
+    };
+
+    auto step = [&](const PolymerMatrix<T>& a)
+    {
+        PolymerMatrix<T> out(n, vector<T>(n, zero));
+        for (size_t row = 0; row < n; ++row)
+        {
+            const vector<T>& fromLeft = a[left[row]];
+            for (size_t col = 0; col < n; ++col)
+                out[row][col] = mulAdd(zero, one, fromLeft[col]);
+            if (size_t(right[row]) == n)
+                continue;
+
+            const vector<T>& fromRight = a[right[row]];
+            for (size_t col = 0; col < n; ++col)
+                out[row][col] = mulAdd(out[row][col], one, fromRight[col]);
+        }
+        return out;
+    };
+
+    for (int bit = int(bit_width(uint64_t(max<int64_t>(numSteps, 0)))) - 1; bit >= 0; --bit)
+    {
+        result = square(result);
+        if ((numSteps >> bit) & 1)
+            result = step(result);
+    }
+    return result;
 }
 
-char findElementToInsert(const char* old, const PolyRules& rules)
+vector<uint64_t> PolymerEngine::elementCountsMod(int64_t numSteps, uint64_t modulus) const
 {
-    PolyKey key = *reinterpret_cast<const PolyKey*>(old);
-    auto itFound = ranges::find_if(rules, [=](const auto& rule) { return key == rule.first; });
-    if (itFound != rules.end())
-        return itFound->second;
+    if (modulus == 0 || modulus > UINT32_MAX)
+        throw "polymer modulus must fit in 32 bits, or the products won't fit in 64";
 
-    _ASSERT(false);
-    return '!';
+    auto power = polymerMatPow<uint64_t>(m_left, m_right, numSteps, 0, 1,
+        [=](uint64_t acc, uint64_t a, uint64_t b) { return (acc + a * b) % modulus; });
+
+    vector<uint64_t> counts(m_numPairs, 0);
+    for (int from = 0; from < m_numPairs; ++from)
+    {
+        uint64_t start = uint64_t(m_start[from]) % modulus;
+        for (int to = 0; to < m_numPairs; ++to)
+            counts[to] = (counts[to] + start * power[from][to]) % modulus;
+    }
+
+    auto result = elementCounts<uint64_t>(counts, 1);
+    for (uint64_t& count : result)
+        count %= modulus;
+    return result;
+}
+
+static double logAddExp(double a, double b)
+{
+    if (a == -INFINITY)
+        return b;
+    if (b == -INFINITY)
+        return a;
+    return max(a, b) + log1p(exp(-abs(a - b)));
+}
+
+// the natural log of how many of each element there are, -inf for none at all. only good for ranking, but the
+// counts can be a million bits long and some elements' share shrinks geometrically, so anything without logs
+// would overflow or underflow
+vector<double> PolymerEngine::elementLogCounts(int64_t numSteps) const
+{
+    auto power = polymerMatPow<double>(m_left, m_right, numSteps, -INFINITY, 0.0,
+        [](double acc, double a, double b) { return logAddExp(acc, a + b); });
+
+    const int k = numElements();
+    vector<double> counts(k, -INFINITY);
+    for (int from = 0; from < m_numPairs; ++from)
+    {
+        if (m_start[from] == 0)
+            continue;
+        for (int to = 0; to < m_numPairs; ++to)
+            counts[to / k] = logAddExp(counts[to / k], log(double(m_start[from])) + power[from][to]);
+    }
+    counts[m_last] = logAddExp(counts[m_last], 0.0);
+    return counts;
 }
 
+
 int64_t day14(const stringlist& input, int numSteps=10)
 {
-    auto [poly, rules] = parsePolymers(input);
-    PolyPairCount count, working;
-    for (auto& [key, val] : rules)
+    PolymerEngine engine(input);
+    auto counts = engine.elementCountsAfter(numSteps);
+
+    auto maxCount = ranges::max(counts);
+    auto minCount = ranges::min(counts | views::filter([](auto count) { return count > 0; }));
+
+    return maxCount - minCount;
+}
+
+// (most common - least common) mod some modulus < 2^32, for step counts way past where the counts fit in any int
+int64_t day14_mod(const stringlist& input, int64_t numSteps, uint64_t modulus)
+{
+    PolymerEngine engine(input);
+    auto counts = engine.elementCountsMod(numSteps, modulus);
+    auto logCounts = engine.elementLogCounts(numSteps);
+
+    int most = int(ranges::max_element(logCounts) - begin(logCounts));
+    int least = most;
+    for (int element = 0; element < engine.numElements(); ++element)
     {
-        count.try_emplace(key, 0);
-        working.try_emplace(key, 0);
+        if (logCounts[element] > -INFINITY && logCounts[element] < logCounts[least])
+            least = element;
     }
 
-    char* in = poly.data();
-    const char* end = in + poly.size() - 1;
-    for (; in != end; ++in)
+    return int64_t((counts[most] + modulus - counts[least]) % modulus);
+}
+
+
+// ---- the polymer itself ----
+// after N steps each pair of the template has grown into a binary tree N deep: the element inserted between them, with
+// the left pair's tree before it and the right pair's after. walking those trees in order spells out the polymer, and
+// needs nothing more than a stack N deep however long the polymer gets
+
+class PolymerWriter
+{
+    ostream& m_os;
+    array<char, 64 * 1024> m_buffer;
+    size_t m_used = 0;
+
+public:
+    PolymerWriter(ostream& os) : m_os(os) { /**/ }
+    ~PolymerWriter() { flush(); }
+
+    void put(char c)
+    {
+        if (m_used == m_buffer.size())
+            flush();
+        m_buffer[m_used++] = c;
+    }
+
+    void flush()
     {
-        PolyKey key = *reinterpret_cast<const PolyKey*>(in);
-        ++count[key];
+        m_os.write(m_buffer.data(), m_used);
+        m_used = 0;
     }
+};
 
-    for (int i=0; i<numSteps; ++i)
+void writePolymer(const PolymerEngine& engine, int numSteps, ostream& os)
+{
+    struct Frame
+    {
+        int pair;
+        int depth;          // how many more steps below this pair
+        bool leftDone;
+    };
+
+    const string& elements = engine.getElements();
+    const vector<int>& polymer = engine.getPolymer();
+    PolymerWriter out(os);
+    vector<Frame> stack;
+    stack.reserve(numSteps + 1);
+
+    out.put(elements[polymer[0]]);
+    for (size_t i = 1; i < polymer.size(); ++i)
     {
-        for (auto& [key, oldval] : count)
+        stack.push_back({ engine.pairOf(polymer[i - 1], polymer[i]), numSteps, false });
+        while (!stack.empty())
         {
-            const char* oldpair = reinterpret_cast<const char*>(&key);
-            char newel = findElementToInsert(oldpair, rules);
+            Frame& frame = stack.back();
+            if (frame.depth == 0 || !engine.hasRule(frame.pair))
+            {
+                stack.pop_back();
+            }
+            else if (!frame.leftDone)
+            {
+                frame.leftDone = true;
+                stack.push_back({ engine.leftPair(frame.pair), frame.depth - 1, false });
+            }
+            else
+            {
+                // the left tree's done, so it's our turn, then the right tree replaces us
+                out.put(elements[engine.insertion(frame.pair)]);
+                frame = { engine.rightPair(frame.pair), frame.depth - 1, false };
+            }
+        }
+        out.put(elements[polymer[i]]);
+    }
+}
+
+// random access into the polymer, knowing how many elements every pair grows in between its ends at every depth.
+// lengths saturate rather than overflow -- nobody's asking for position 2^64 -- so once every tree that grows at all
+// has saturated (usually by depth 64), a depth's lengths are the same as the one below and so are all the ones above.
+// levels are only kept up to there. a grammar whose trees grow slower than that never settles, so it keeps every
+// kLevelBlock'th level and at() regrows the block of levels it's walking through from the one below it
+class PolymerIndex
+{
+    static constexpr int kLevelBlock = 1024;
 
-            char newpair[2] = { oldpair[0], newel };
-            PolyKey* newkey = reinterpret_cast<PolyKey*>(&newpair[0]);
-            working[*newkey] += oldval;
+    const PolymerEngine& m_engine;
+    int m_numSteps;
+    int m_topDepth;                         // every depth past this has the same lengths as it
+    vector<vector<uint64_t>> m_checkpoints; // by depth / kLevelBlock, then pair: elements inserted between its ends
+    vector<uint64_t> m_top;                 // the lengths at m_topDepth
 
-            newpair[0] = newel;
-            newpair[1] = oldpair[1];
-            working[*newkey] += oldval;
+    static uint64_t addSaturated(uint64_t a, uint64_t b) { return (a + b < a) ? UINT64_MAX : a + b; }
+
+    void grow(const vector<uint64_t>& below, vector<uint64_t>& level) const
+    {
+        level.assign(m_engine.numPairs(), 0);
+        for (int pair = 0; pair < m_engine.numPairs(); ++pair)
+        {
+            if (m_engine.hasRule(pair))
+                level[pair] = addSaturated(addSaturated(below[m_engine.leftPair(pair)], 1), below[m_engine.rightPair(pair)]);
         }
+    }
+
+public:
+    PolymerIndex(const PolymerEngine& engine, int numSteps) : m_engine(engine), m_numSteps(numSteps)
+    {
+        m_top.assign(engine.numPairs(), 0);
+        m_checkpoints.push_back(m_top);
 
-        count.swap(working);
-        for (auto& kv : working)
-            kv.second = 0;
+        vector<uint64_t> level;
+        for (m_topDepth = 0; m_topDepth < numSteps; ++m_topDepth)
+        {
+            grow(m_top, level);
+            if (level == m_top)
+                break;
+
+            swap(level, m_top);
+            if ((m_topDepth + 1) % kLevelBlock == 0)
+                m_checkpoints.push_back(m_top);
+        }
     }
 
-    int64_t hist[256];
-    ranges::fill(hist, 0);
-    for (auto& [key, val] : count)
+    uint64_t length() const
     {
-        const char* oldpair = reinterpret_cast<const char*>(&key);
-        hist[oldpair[0]] += val;
+        const vector<int>& polymer = m_engine.getPolymer();
+        uint64_t total = polymer.size();
+        for (size_t i = 1; i < polymer.size(); ++i)
+            total = addSaturated(total, m_top[m_engine.pairOf(polymer[i - 1], polymer[i])]);
+        return total;
     }
-    hist[poly.back()]++;
 
-    auto maxCount = ranges::max(hist);
-    auto minCount = ranges::min(hist | views::filter([](auto count) { return count > 0; }));
+    char at(uint64_t pos) const
+    {
+        // the descent only ever goes down a depth, so each block of levels is regrown at most once per call
+        vector<vector<uint64_t>> block;
+        int blockStart = -1;
+        auto grownAt = [&](int depth) -> const vector<uint64_t>&
+        {
+            if (depth >= m_topDepth)
+                return m_top;
 
-    return maxCount - minCount;
+            const int start = depth / kLevelBlock * kLevelBlock;
+            if (start != blockStart)
+            {
+                const int size = min(kLevelBlock, m_topDepth - start);
+                block.resize(size);
+                block[0] = m_checkpoints[start / kLevelBlock];
+                for (int i = 1; i < size; ++i)
+                    grow(block[i - 1], block[i]);
+                blockStart = start;
+            }
+            return block[depth - start];
+        };
+
+        const vector<int>& polymer = m_engine.getPolymer();
+        for (size_t i = 0; ; ++i)
+        {
+            if (pos == 0 || i + 1 == polymer.size())
+                return pos == 0 ? m_engine.getElements()[polymer[i]] : '\0';
+            --pos;
+
+            int pair = m_engine.pairOf(polymer[i], polymer[i + 1]);
+            if (pos >= m_top[pair])
+            {
+                pos -= m_top[pair];
+                continue;
+            }
+
+            for (int depth = m_numSteps; ; --depth)
+            {
+                uint64_t leftLength = grownAt(depth - 1)[m_engine.leftPair(pair)];
+                if (pos < leftLength)
+                {
+                    pair = m_engine.leftPair(pair);
+                }
+                else if (pos == leftLength)
+                {
+                    return m_engine.getElements()[m_engine.insertion(pair)];
+                }
+                else
+                {
+                    pos -= leftLength + 1;
+                    pair = m_engine.rightPair(pair);
+                }
+            }
+        }
+    }
+};
+
+string day14_polymer(const stringlist& input, int numSteps)
+{
+    ostringstream os;
+    writePolymer(PolymerEngine(input), numSteps, os);
+    return os.str();
 }
 
 
@@ -114,8 +469,44 @@ CC -> N
 CN -> C)";
 
     test<int64_t>(1588, day14(READ(sample)));
+    test(string("NCNBCHB"), day14_polymer(READ(sample), 1));
+    test(string("NBBNBNBBCCNBCNCCNBBNBBNBBBNBBNBBCBHCBHHNHCBBCBHCB"), day14_polymer(READ(sample), 4));
+    const stringlist expansions = LOAD(14t);             // 14t is the polymer after each of the first 10 steps
+    for (int numSteps = 1; numSteps <= int(expansions.size()); ++numSteps)
+        test(expansions[numSteps - 1], day14_polymer(LOAD(14), numSteps));
+
+    PolymerEngine sampleEngine(READ(sample));
+    PolymerIndex sampleIndex(sampleEngine, 10);
+    const string sample10 = day14_polymer(READ(sample), 10);
+    test(uint64_t(3073), sampleIndex.length());
+    test(sample10[0], sampleIndex.at(0));
+    test(sample10[1234], sampleIndex.at(1234));
+    test(sample10[3072], sampleIndex.at(3072));
+    test('\0', sampleIndex.at(3073));
+    // the sample's first pair soon becomes NB, whose tree at each depth starts with its whole tree from the depth
+    // before, so the front of the polymer stops changing and step 20 can vouch for step 40
+    PolymerIndex deepIndex(sampleEngine, 40);
+    test(day14_polymer(READ(sample), 20)[54321], deepIndex.at(54321));
+    PolymerIndex hugeIndex(sampleEngine, 1000000);
+    test(UINT64_MAX, hugeIndex.length());
+    test(day14_polymer(READ(sample), 20)[54321], hugeIndex.at(54321));
+    // AB -> A only ever grows by one, so it never settles and has to be walked from the checkpoints
+    PolymerEngine slowEngine(READ("AB\n\nAB -> A"));
+    PolymerIndex slowIndex(slowEngine, 1000000);
+    test(uint64_t(1000002), slowIndex.length());
+    test('A', slowIndex.at(3000));
+    test('A', slowIndex.at(1000000));
+    test('B', slowIndex.at(1000001));
+    test(string("AAAAAB"), day14_polymer(READ("AB\n\nAB -> A"), 4));
     gogogo(day14(LOAD(14)));
 
     test<int64_t>(2188189693529, day14(READ(sample), 40));
+    test<int64_t>(2188189693529 % 1000000007, day14_mod(READ(sample), 40, 1000000007));
+    test<int64_t>(3459822539451 % 998244353, day14_mod(LOAD(14), 40, 998244353));
+    test<int64_t>(561095752, day14_mod(READ(sample), 1000000, 1000000007));
+    test<int64_t>(96233320, day14_mod(LOAD(14), 20000, 1000000007));
+    string bigModulus;
+    try { day14_mod(READ(sample), 40, 1ull << 32); } catch (const char* error) { bigModulus = error; }
+    test(string("polymer modulus must fit in 32 bits, or the products won't fit in 64"), bigModulus);
     gogogo(day14(LOAD(14), 40));
 }
\ No newline at end of file
@@ -1,24 +1,29 @@
 #include "pch.h"
 #include "harness.h"
 
+#include <immintrin.h>
 #include <ranges>
 
-struct Board
+template<int Size = 5, typename CellT = uint8_t>
+struct BingoBoard
 {
-    using Cell = uint8_t;
-    static const int kSize = 5;
-    static const Cell kDrawn = (1 << (sizeof(Cell) * 8 - 1));
+    using Cell = CellT;
+    static const int kSize = Size;
+    static const Cell kDrawn = Cell(1 << (sizeof(Cell) * 8 - 1));
 
-    Cell cells[kSize * kSize];   // MSB is 1 if number has been drawn
+    Cell cells[kSize * kSize];   // MSB is 1 if number has been drawn (onDraw only -- getWinTurnAndUnmarkedSum uses the full range)
 
-    Board(stringlist::const_iterator& itLine)
+    BingoBoard(stringlist::const_iterator& itLine)
     {
         auto pCell = &cells[0];
         for (int row = 0; row < kSize; ++row)
         {
+            const char* curr = itLine->c_str();
             for (int col = 0; col < kSize; ++col)
             {
-                *pCell = Cell(strtol(itLine->c_str() + (col*3), nullptr, 10));
+                char* next;
+                *pCell = Cell(strtol(curr, &next, 10));
+                curr = next;
                 ++pCell;
             }
             ++itLine;
@@ -81,11 +86,154 @@ struct Board
         }
         return total;
     }
+
+    pair<int, int64_t> getWinTurnAndUnmarkedSum(const vector<uint16_t>& turnOf) const;
 };
 
-vector<Board> loadBoards(const stringlist& input)
+using Board = BingoBoard<>;
+
+
+// turnOf[n] is the index of the draw that calls n, or kNeverDrawn. only numbers up to maxCell can be on a board, so
+// bigger draws are skipped rather than growing the table out to them
+static constexpr uint16_t kNeverDrawn = 0xffff;
+
+vector<uint16_t> getDrawTurns(const vector<int>& draws, int maxCell)
+{
+    if (draws.size() >= kNeverDrawn)
+        throw "too many draws to fit a turn in 16 bits";
+    if (!draws.empty() && ranges::min(draws) < 0)
+        throw "draws can't be negative";
+
+    vector<uint16_t> turnOf(size_t(maxCell) + 1, kNeverDrawn);
+    for (int turn = int(draws.size()) - 1; turn >= 0; --turn)
+    {
+        if (draws[turn] <= maxCell)
+            turnOf[draws[turn]] = uint16_t(turn);     // backwards so repeated draws keep their first turn
+    }
+
+    return turnOf;
+}
+
+inline uint16_t hmin_epu16(__m256i v)
 {
-    vector<Board> boards;
+    __m128i m = _mm_min_epu16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    return uint16_t(_mm_cvtsi128_si32(_mm_minpos_epu16(m)));
+}
+
+inline uint16_t hmax_epu16(__m256i v)
+{
+    const __m256i ones = _mm256_set1_epi16(-1);
+    return uint16_t(~hmin_epu16(_mm256_xor_si256(v, ones)));
+}
+
+// a board's turns or values, one row per 16 lanes with zeros past the board size
+using BingoLanes = uint16_t[16];
+
+pair<int, int64_t> scoreBingoScalar(const BingoLanes* turns, const BingoLanes* values, int size)
+{
+    uint16_t winTurn = kNeverDrawn;
+    for (int i = 0; i < size; ++i)
+    {
+        uint16_t rowMax = 0;
+        uint16_t colMax = 0;
+        for (int j = 0; j < size; ++j)
+        {
+            rowMax = max(rowMax, turns[i][j]);
+            colMax = max(colMax, turns[j][i]);
+        }
+        winTurn = min({ winTurn, rowMax, colMax });
+    }
+
+    if (winTurn == kNeverDrawn)
+        return { INT_MAX, 0 };
+
+    int64_t unmarkedSum = 0;
+    for (int row = 0; row < size; ++row)
+    {
+        for (int col = 0; col < size; ++col)
+        {
+            if (turns[row][col] > winTurn)
+                unmarkedSum += values[row][col];
+        }
+    }
+
+    return { int(winTurn), unmarkedSum };
+}
+
+// a line completes on the max turn of its cells, and the board wins on the min over all its lines -- so each row
+// is a 16-lane vector of turns, the column maxes are a running vertical max and the row maxes are horizontal
+pair<int, int64_t> scoreBingoAvx2(const BingoLanes* turns, const BingoLanes* values, int size)
+{
+    __m256i colMax = _mm256_setzero_si256();
+    uint16_t winTurn = kNeverDrawn;
+    for (int row = 0; row < size; ++row)
+    {
+        __m256i rowTurns = _mm256_load_si256(reinterpret_cast<const __m256i*>(turns[row]));
+        colMax = _mm256_max_epu16(colMax, rowTurns);
+        winTurn = min(winTurn, hmax_epu16(rowTurns));
+    }
+
+    // the unused lanes past size are zero, so stop them looking like columns that won on turn 0
+    alignas(32) uint16_t padding[16];
+    for (int col = 0; col < 16; ++col)
+        padding[col] = (col < size) ? 0 : kNeverDrawn;
+    colMax = _mm256_or_si256(colMax, _mm256_load_si256(reinterpret_cast<const __m256i*>(padding)));
+    winTurn = min(winTurn, hmin_epu16(colMax));
+
+    if (winTurn == kNeverDrawn)
+        return { INT_MAX, 0 };
+
+    // sum every cell that was still unmarked after the winning turn
+    const __m256i win = _mm256_set1_epi16(int16_t(winTurn));
+    __m256i sum = _mm256_setzero_si256();
+    for (int row = 0; row < size; ++row)
+    {
+        __m256i rowTurns = _mm256_load_si256(reinterpret_cast<const __m256i*>(turns[row]));
+        __m256i rowValues = _mm256_load_si256(reinterpret_cast<const __m256i*>(values[row]));
+
+        __m256i marked = _mm256_cmpeq_epi16(_mm256_max_epu16(rowTurns, win), win);    // turn <= winTurn
+        __m256i unmarked = _mm256_andnot_si256(marked, rowValues);
+
+        sum = _mm256_add_epi32(sum, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(unmarked)));
+        sum = _mm256_add_epi32(sum, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(unmarked, 1)));
+    }
+
+    alignas(32) uint32_t sums[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(sums), sum);
+    int64_t unmarkedSum = accumulate(begin(sums), end(sums), 0ll);
+
+    return { int(winTurn), unmarkedSum };
+}
+
+// rather than marking cells one draw at a time, we translate every cell into the turn it gets called on and work out
+// when the board wins from that. a board that never wins comes back as { INT_MAX, 0 }
+template<int Size, typename CellT>
+pair<int, int64_t> BingoBoard<Size, CellT>::getWinTurnAndUnmarkedSum(const vector<uint16_t>& turnOf) const
+{
+    static_assert(kSize <= 16, "each row needs to fit in one vector of 16-bit lanes");
+    static_assert(sizeof(CellT) <= 2, "cell values are scored in 16-bit lanes");
+
+    alignas(32) BingoLanes turns[kSize] = {};
+    alignas(32) BingoLanes values[kSize] = {};
+
+    const Cell* cell = cells;
+    for (int row = 0; row < kSize; ++row)
+    {
+        for (int col = 0; col < kSize; ++col, ++cell)
+        {
+            values[row][col] = uint16_t(*cell);
+            turns[row][col] = (size_t(*cell) < turnOf.size()) ? turnOf[*cell] : kNeverDrawn;
+        }
+    }
+
+    return cpuFeatures().avx2 ? scoreBingoAvx2(turns, values, kSize) : scoreBingoScalar(turns, values, kSize);
+}
+
+
+template<typename TBoard = Board>
+vector<TBoard> loadBoards(const stringlist& input)
+{
+    vector<TBoard> boards;
     for (auto itLine = input.begin() + 2; itLine != input.end(); )
     {
         if (itLine->length() == 0)
@@ -99,10 +247,16 @@ vector<Board> loadBoards(const stringlist& input)
     return boards;
 }
 
-int day4(const stringlist& input)
+vector<int> loadDraws(const stringlist& input)
 {
     vector<int> draws;
     ranges::transform(split(input[0], ","), back_inserter(draws), [](const string& draw) { return stoi(draw); });
+    return draws;
+}
+
+int day4(const stringlist& input)
+{
+    auto draws = loadDraws(input);
 
     auto boards = loadBoards(input);
 
@@ -122,8 +276,7 @@ int day4(const stringlist& input)
 
 int day4_2(const stringlist& input)
 {
-    vector<int> draws;
-    ranges::transform(split(input[0], ","), back_inserter(draws), [](const string& draw) { return stoi(draw); });
+    auto draws = loadDraws(input);
 
     auto boards = loadBoards(input);
 
@@ -154,6 +307,43 @@ int day4_2(const stringlist& input)
 }
 
 
+struct BingoResult
+{
+    int boardIx;
+    int winTurn;
+    int64_t score;      // unmarked sum * winning draw
+};
+
+// every winning board's result, ordered by the turn it wins on (ties stay in board order). boards that never win are
+// left out, so back() really is the last board to win
+template<typename TBoard>
+vector<BingoResult> rankBoards(const vector<int>& draws, const vector<TBoard>& boards)
+{
+    int maxCell = 0;
+    for (const TBoard& board : boards)
+        maxCell = max(maxCell, int(ranges::max(board.cells)));
+    auto turnOf = getDrawTurns(draws, maxCell);
+
+    vector<BingoResult> results;
+    results.reserve(boards.size());
+    for (int ix = 0; ix < int(boards.size()); ++ix)
+    {
+        auto [winTurn, unmarkedSum] = boards[ix].getWinTurnAndUnmarkedSum(turnOf);
+        if (winTurn != INT_MAX)
+            results.push_back({ ix, winTurn, unmarkedSum * draws[winTurn] });
+    }
+
+    ranges::stable_sort(results, {}, &BingoResult::winTurn);
+    return results;
+}
+
+template<typename TBoard = Board>
+vector<BingoResult> day4_tournament(const stringlist& input)
+{
+    return rankBoards(loadDraws(input), loadBoards<TBoard>(input));
+}
+
+
 void run_day4()
 {
     string sample =
@@ -181,5 +371,37 @@ R"(7,4,9,5,11,17,23,2,0,14,21,24,10,16,13,6,15,25,12,22,18,20,8,19,3,26,1
     gogogo(day4(LOAD(4)));
 
     test(1924, day4_2(READ(sample)));
+
+    auto ranking = day4_tournament(READ(sample));
+    test(4512ll, ranking.front().score);
+    test(1924ll, ranking.back().score);
+    test(1, ranking.back().boardIx);
+    stringlist fewDraws = READ(sample);
+    fewDraws[0] = "7,4,9,5,11,17,23,2,0,14,21,24,10,16";    // board 1 never gets a line
+    auto partialRanking = day4_tournament(fewDraws);
+    test(size_t(2), partialRanking.size());
+    test(0, partialRanking.back().boardIx);
+
+    string bigsample =
+R"(60000,3,65000,40000,9,1000,50000,300
+
+65000     1     2     3     4     5
+  300     6     7     8     9    10
+40000    12    13    14    15    16
+ 1000    17    18    19    20    21
+50000    23    24    25    26    27
+60000    28    29    30    31    32)";
+
+    test(size_t(6), getDrawTurns({ 3, 65000, 1 }, 5).size());
+    test(uint16_t(2), getDrawTurns({ 3, 65000, 1 }, 5)[1]);
+
+    auto bigRanking = day4_tournament<BingoBoard<6, uint16_t>>(READ(bigsample));
+    test(7, bigRanking.front().winTurn);
+    test(144900ll, bigRanking.front().score);
+
+    auto fullRanking = day4_tournament(LOAD(4));
+    test(38594ll, fullRanking.front().score);
+    test(21184ll, fullRanking.back().score);
+
     gogogo(day4_2(LOAD(4)));
 }
\ No newline at end of file
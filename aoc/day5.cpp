@@ -2,10 +2,17 @@
 #include "harness.h"
 #include "pt2.h"
 
+#include <atomic>
+#include <bit>
+#include <immintrin.h>
+#include <random>
+#include <set>
+#include <thread>
+
 
 struct Line
 {
-    using Pt = Pt2i16;
+    using Pt = Pt2i;
 
     Pt start, end;
 
@@ -68,9 +75,8 @@ Map createMap(const vector<Line>& lines)
     return Map(maxx + 1, maxy + 1);
 }
 
-int day5(const stringlist& input)
+int64_t countOverlapsRaster(const vector<Line>& lines, bool withDiagonals)
 {
-    auto lines = loadLines(input);
     Map map = createMap(lines);
     auto cells = map.data();
 
@@ -92,47 +98,474 @@ int day5(const stringlist& input)
             for (Cell* curr = start; curr != end; ++curr)
                 (*curr)++;
         }
+        else if (withDiagonals)
+        {
+            const int incy = (line.start.y < line.end.y) ? 1 : -1;
+            const int incx = (line.start.x < line.end.x) ? 1 : -1;
+            for (int y = line.start.y, x = line.start.x; (incy > 0 && y <= line.end.y) || (incy <= 0 && y >= line.end.y); y += incy, x += incx)
+            {
+                cells[x + (y * map.width)]++;
+            }
+        }
     }
 
-    return (int)ranges::count_if(map.cells, [](auto cell) { return cell > 1; });
+    return ranges::count_if(map.cells, [](auto cell) { return cell > 1; });
 }
 
-int day5_2(const stringlist& input)
+
+// ---- sweep line ----
+// every vent line belongs to one of four families, and within a family each line is an interval of the param t along
+// a fixed key:  horizontal (key=y, t=x), vertical (key=x, t=y), down-diagonal (key=x-y, t=x), up-diagonal (key=x+y, t=x)
+//
+// a point is covered twice either by two lines of the same family (collinear overlap), or by lines from two different
+// families (a crossing). so per family we sweep the intervals to get what's covered once and twice, then cross each
+// pair of families against each other -- all in memory proportional to the number of lines, not the map area
+
+enum LineFamily { Horizontal, Vertical, DiagDown, DiagUp, NumFamilies };
+
+using Pt64 = Pt2<int64_t>;
+
+struct Span
 {
-    auto lines = loadLines(input);
-    Map map = createMap(lines);
-    auto cells = map.data();
+    int64_t key, lo, hi;
 
-    for (const Line& line : lines)
+    auto operator<=>(const Span&) const = default;
+};
+
+struct FamilyCover
+{
+    vector<Span> once;      // disjoint & sorted, covered by at least one line
+    vector<Span> twice;     // disjoint & sorted, covered by at least two lines
+};
+
+// key = kx * x + ky * y
+static constexpr int64_t kFamilyKeyCoeffs[NumFamilies][2] = { {0, 1}, {1, 0}, {1, -1}, {1, 1} };
+
+inline int64_t familyKey(int family, const Pt64& p)
+{
+    return kFamilyKeyCoeffs[family][0] * p.x + kFamilyKeyCoeffs[family][1] * p.y;
+}
+
+inline int64_t familyParam(int family, const Pt64& p)
+{
+    return (family == Vertical) ? p.y : p.x;
+}
+
+inline Pt64 familyPoint(int family, int64_t key, int64_t t)
+{
+    switch (family)
     {
-        if (line.start.x == line.end.x)     // vertical line
+    case Horizontal:    return { t, key };
+    case Vertical:      return { key, t };
+    case DiagDown:      return { t, t - key };
+    default:            return { t, key - t };
+    }
+}
+
+FamilyCover coverFamily(const vector<Span>& spans)
+{
+    vector<tuple<int64_t, int64_t, int>> events;
+    events.reserve(spans.size() * 2);
+    for (const Span& span : spans)
+    {
+        events.emplace_back(span.key, span.lo, 1);
+        events.emplace_back(span.key, span.hi + 1, -1);
+    }
+    ranges::sort(events);
+
+    auto append = [](vector<Span>& out, int64_t key, int64_t lo, int64_t hi)
+    {
+        if (!out.empty() && out.back().key == key && out.back().hi + 1 == lo)
+            out.back().hi = hi;
+        else
+            out.push_back({ key, lo, hi });
+    };
+
+    FamilyCover cover;
+    int count = 0;
+    for (size_t i = 0; i + 1 < events.size(); ++i)
+    {
+        auto [key, t, delta] = events[i];
+        count += delta;
+
+        auto [nextKey, nextT, nextDelta] = events[i + 1];
+        if (nextKey != key || nextT == t)
+            continue;
+
+        if (count >= 1)
+            append(cover.once, key, t, nextT - 1);
+        if (count >= 2)
+            append(cover.twice, key, t, nextT - 1);
+    }
+
+    return cover;
+}
+
+// every lattice point where a line of family va meets a line of family hb. in (a,b) = (key_va, key_hb) space the va
+// lines are vertical and the hb lines are horizontal, so this is the classic orthogonal segment intersection sweep
+template<typename OnCrossing>
+void crossFamilies(int va, const vector<Span>& vert, int hb, const vector<Span>& horz, OnCrossing&& onCrossing)
+{
+    enum { Insert, Query, Remove };
+    struct Event
+    {
+        int64_t b;
+        int type;
+        int64_t a0, a1;
+
+        auto operator<=>(const Event&) const = default;
+    };
+
+    vector<Event> events;
+    events.reserve(vert.size() * 2 + horz.size());
+    for (const Span& span : vert)
+    {
+        auto [b0, b1] = minmax({ familyKey(hb, familyPoint(va, span.key, span.lo)), familyKey(hb, familyPoint(va, span.key, span.hi)) });
+        events.push_back({ b0, Insert, span.key, span.key });
+        events.push_back({ b1, Remove, span.key, span.key });
+    }
+    for (const Span& span : horz)
+    {
+        auto [a0, a1] = minmax({ familyKey(va, familyPoint(hb, span.key, span.lo)), familyKey(va, familyPoint(hb, span.key, span.hi)) });
+        events.push_back({ span.key, Query, a0, a1 });
+    }
+    ranges::sort(events);
+
+    // solve kx_a * x + ky_a * y = a, kx_b * x + ky_b * y = b. diagonals crossing each other can meet between cells
+    const auto [kxa, kya] = kFamilyKeyCoeffs[va];
+    const auto [kxb, kyb] = kFamilyKeyCoeffs[hb];
+    const int64_t det = kxa * kyb - kya * kxb;
+    _ASSERT(det != 0);
+
+    multiset<int64_t> active;
+    for (const Event& ev : events)
+    {
+        switch (ev.type)
         {
-            auto [starty, endy] = minmax(line.start.y, line.end.y);
-            Cell* start = cells + (starty * map.width) + line.start.x;
-            Cell* end = start + (endy - starty + 1) * map.width;;
-            for (Cell* curr = start; curr != end; curr += map.width)
-                (*curr)++;
+        case Insert:
+            active.insert(ev.a0);
+            break;
+
+        case Remove:
+            active.erase(active.find(ev.a0));
+            break;
+
+        case Query:
+            for (auto it = active.lower_bound(ev.a0); it != active.end() && *it <= ev.a1; ++it)
+            {
+                int64_t xnum = *it * kyb - kya * ev.b;
+                int64_t ynum = kxa * ev.b - *it * kxb;
+                if (xnum % det == 0 && ynum % det == 0)
+                    onCrossing(Pt64{ xnum / det, ynum / det });
+            }
+            break;
         }
-        else if (line.start.y == line.end.y)    // horizontal line
+    }
+}
+
+bool isCoveredBy(const vector<Span>& spans, int64_t key, int64_t t)
+{
+    auto it = ranges::upper_bound(spans, Span{ key, t, INT64_MAX });
+    if (it == spans.begin())
+        return false;
+    --it;
+    return it->key == key && it->lo <= t && t <= it->hi;
+}
+
+int64_t countOverlapsSweep(const vector<Line>& lines, bool withDiagonals)
+{
+    array<vector<Span>, NumFamilies> spans;
+    for (const Line& line : lines)
+    {
+        int family;
+        if (line.start.y == line.end.y)
+            family = Horizontal;
+        else if (line.start.x == line.end.x)
+            family = Vertical;
+        else if (!withDiagonals)
+            continue;
+        else if ((line.end.x - line.start.x) == (line.end.y - line.start.y))
+            family = DiagDown;
+        else
+            family = DiagUp;
+
+        Pt64 start{ line.start.x, line.start.y };
+        Pt64 end{ line.end.x, line.end.y };
+        auto [lo, hi] = minmax({ familyParam(family, start), familyParam(family, end) });
+        spans[family].push_back({ familyKey(family, start), lo, hi });
+    }
+
+    array<FamilyCover, NumFamilies> covers;
+    for (int family = 0; family < NumFamilies; ++family)
+        covers[family] = coverFamily(spans[family]);
+
+    // |crossings U twice_0 U ... U twice_3|, where the twice sets can only meet each other at a crossing
+    int64_t total = 0;
+    for (const FamilyCover& cover : covers)
+    {
+        for (const Span& span : cover.twice)
+            total += span.hi - span.lo + 1;
+    }
+
+    // where three or more families meet, every pair of them finds the point. only the lowest two count it, so nothing
+    // needs remembering to de-duplicate
+    auto isCoveredAt = [&](const vector<Span>& cover, int family, const Pt64& p)
+    {
+        return isCoveredBy(cover, familyKey(family, p), familyParam(family, p));
+    };
+    for (int va = 0; va < NumFamilies; ++va)
+    {
+        for (int hb = va + 1; hb < NumFamilies; ++hb)
         {
-            auto [startx, endx] = minmax(line.start.x, line.end.x);
-            Cell* start = cells + (line.start.y * map.width) + startx;
-            Cell* end = start + (endx - startx + 1);
-            for (Cell* curr = start; curr != end; ++curr)
-                (*curr)++;
+            crossFamilies(va, covers[va].once, hb, covers[hb].once, [&](const Pt64& p)
+            {
+                for (int family = 0; family < hb; ++family)
+                {
+                    if (family != va && isCoveredAt(covers[family].once, family, p))
+                        return;
+                }
+
+                ++total;
+                for (int family = 0; family < NumFamilies; ++family)
+                {
+                    if (isCoveredAt(covers[family].twice, family, p))
+                        --total;
+                }
+            });
         }
-        else // diagonal
+    }
+
+    return total;
+}
+
+
+// ---- tiled raster ----
+// the plain raster walks vertical lines a whole map row apart, so on big maps every step is a cache miss. instead we
+// bin the lines into tiles small enough to live in L2, and give each thread a tile at a time to draw into its own
+// scratch buffer. only "more than once" matters, so each cell is a saturating uint8_t and the tile never gets written
+// back anywhere -- we just count it and move on
+
+static constexpr int kTileShift = 8;
+static constexpr int kTileSize = 1 << kTileShift;
+
+// the run of steps i in [0, len] where start + i*dir lands inside [lo, hi] on one axis
+inline pair<int, int> clipAxis(int start, int dir, int len, int lo, int hi)
+{
+    if (dir == 0)
+        return (start >= lo && start <= hi) ? pair{ 0, len } : pair{ 1, 0 };
+    if (dir > 0)
+        return { max(0, lo - start), min(len, hi - start) };
+    return { max(0, start - hi), min(len, start - lo) };
+}
+
+struct LineWalk
+{
+    int sx, sy, dx, dy, len;
+
+    LineWalk(const Line& line)
+        : sx(line.start.x), sy(line.start.y)
+        , dx((line.end.x > line.start.x) - (line.end.x < line.start.x))
+        , dy((line.end.y > line.start.y) - (line.end.y < line.start.y))
+        , len(max(abs(line.end.x - line.start.x), abs(line.end.y - line.start.y)))
+    { /**/ }
+
+    pair<int, int> clip(int x0, int y0, int x1, int y1) const
+    {
+        auto [ixlo, ixhi] = clipAxis(sx, dx, len, x0, x1);
+        auto [iylo, iyhi] = clipAxis(sy, dy, len, y0, y1);
+        return { max(ixlo, iylo), min(ixhi, iyhi) };
+    }
+};
+
+template<typename Fn>
+void forEachTileOnLine(const LineWalk& walk, Fn&& fn)
+{
+    const int miny = min(walk.sy, walk.sy + walk.dy * walk.len);
+    const int maxy = max(walk.sy, walk.sy + walk.dy * walk.len);
+    for (int ty = miny >> kTileShift; ty <= (maxy >> kTileShift); ++ty)
+    {
+        const int y0 = ty << kTileShift;
+        auto [ilo, ihi] = clipAxis(walk.sy, walk.dy, walk.len, y0, y0 + kTileSize - 1);
+        if (ilo > ihi)
+            continue;
+
+        auto [xa, xb] = minmax({ walk.sx + walk.dx * ilo, walk.sx + walk.dx * ihi });
+        for (int tx = xa >> kTileShift; tx <= (xb >> kTileShift); ++tx)
+            fn(tx, ty);
+    }
+}
+
+int64_t countTileOverlaps(const uint8_t* tile)
+{
+    if (!cpuFeatures().avx2)
+        return ranges::count_if(tile, tile + kTileSize * kTileSize, [](uint8_t cell) { return cell >= 2; });
+
+    const __m256i two = _mm256_set1_epi8(2);
+
+    int64_t count = 0;
+    for (const uint8_t* curr = tile; curr != tile + kTileSize * kTileSize; curr += 32)
+    {
+        __m256i cells = _mm256_load_si256(reinterpret_cast<const __m256i*>(curr));
+        __m256i overlapped = _mm256_cmpeq_epi8(_mm256_max_epu8(cells, two), cells);    // cell >= 2
+        count += popcount(uint32_t(_mm256_movemask_epi8(overlapped)));
+    }
+    return count;
+}
+
+int64_t countOverlapsTiled(const vector<Line>& lines, bool withDiagonals, unsigned numThreads = thread::hardware_concurrency())
+{
+    vector<LineWalk> walks;
+    walks.reserve(lines.size());
+    int maxx = 0, maxy = 0;
+    for (const Line& line : lines)
+    {
+        if (!withDiagonals && line.start.x != line.end.x && line.start.y != line.end.y)
+            continue;
+
+        walks.emplace_back(line);
+        maxx = max({ maxx, line.start.x, line.end.x });
+        maxy = max({ maxy, line.start.y, line.end.y });
+    }
+
+    const int tilesX = (maxx >> kTileShift) + 1;
+    const int tilesY = (maxy >> kTileShift) + 1;
+    const int numTiles = tilesX * tilesY;
+
+    // counting sort of line indices by tile
+    vector<uint32_t> binStart(numTiles + 1, 0);
+    for (const LineWalk& walk : walks)
+        forEachTileOnLine(walk, [&](int tx, int ty) { ++binStart[tx + ty * tilesX + 1]; });
+    partial_sum(begin(binStart), end(binStart), begin(binStart));
+
+    vector<uint32_t> binned(binStart.back());
+    vector<uint32_t> binFill(begin(binStart), end(binStart) - 1);
+    for (uint32_t ix = 0; ix < uint32_t(walks.size()); ++ix)
+        forEachTileOnLine(walks[ix], [&](int tx, int ty) { binned[binFill[tx + ty * tilesX]++] = ix; });
+
+    atomic<int> nextTile = 0;
+    auto drawTiles = [&](int64_t* result)
+    {
+        const size_t tileBytes = kTileSize * kTileSize;
+        uint8_t* tile = reinterpret_cast<uint8_t*>(_aligned_malloc(tileBytes, 64));
+
+        int64_t overlaps = 0;
+        for (int tileIx = nextTile++; tileIx < numTiles; tileIx = nextTile++)
         {
-            const int incy = (line.start.y < line.end.y) ? 1 : -1;
-            const int incx = (line.start.x < line.end.x) ? 1 : -1;
-            for (int y = line.start.y, x = line.start.x; (incy > 0 && y <= line.end.y) || (incy <= 0 && y >= line.end.y); y += incy, x += incx)
+            if (binStart[tileIx + 1] - binStart[tileIx] < 2)
+                continue;   // a single line can't overlap itself
+
+            memset(tile, 0, tileBytes);
+            const int x0 = (tileIx % tilesX) << kTileShift;
+            const int y0 = (tileIx / tilesX) << kTileShift;
+
+            for (uint32_t b = binStart[tileIx]; b != binStart[tileIx + 1]; ++b)
             {
-                cells[x + (y * map.width)]++;
+                const LineWalk& walk = walks[binned[b]];
+                auto [ilo, ihi] = walk.clip(x0, y0, x0 + kTileSize - 1, y0 + kTileSize - 1);
+
+                const int step = walk.dx + walk.dy * kTileSize;
+                uint8_t* cell = tile + (walk.sx + walk.dx * ilo - x0) + (walk.sy + walk.dy * ilo - y0) * kTileSize;
+                for (int i = ilo; i <= ihi; ++i, cell += step)
+                    *cell = uint8_t(*cell + (*cell != 0xff));
             }
+
+            overlaps += countTileOverlaps(tile);
         }
+
+        _aligned_free(tile);
+        *result = overlaps;
+    };
+
+    numThreads = clamp(numThreads, 1u, unsigned(numTiles));
+    vector<int64_t> overlaps(numThreads, 0);
+    parallelFor(numThreads, [&](unsigned band) { drawTiles(&overlaps[band]); });
+
+    return accumulate(begin(overlaps), end(overlaps), 0ll);
+}
+
+
+// the dense map is much quicker while it comfortably fits in cache-ish memory; past that we tile it, and once the
+// map is too big to even walk every cell we stop rasterising and sweep instead
+static constexpr int64_t kMaxRasterCells = 1 << 20;
+static constexpr int64_t kMaxTiledCells = 1ll << 28;
+
+int64_t countOverlaps(const vector<Line>& lines, bool withDiagonals)
+{
+    int64_t maxx = 0, maxy = 0;
+    for (const Line& line : lines)
+    {
+        maxx = max<int64_t>(maxx, max(line.start.x, line.end.x));
+        maxy = max<int64_t>(maxy, max(line.start.y, line.end.y));
     }
 
-    return (int)ranges::count_if(map.cells, [](auto cell) { return cell > 1; });
+    const int64_t numCells = (maxx + 1) * (maxy + 1);
+    if (numCells <= kMaxRasterCells)
+        return countOverlapsRaster(lines, withDiagonals);
+    if (numCells <= kMaxTiledCells)
+        return countOverlapsTiled(lines, withDiagonals);
+
+    return countOverlapsSweep(lines, withDiagonals);
+}
+
+// numLines random horizontal, vertical & diagonal lines on a size x size map, through each path that can take them.
+// run_day5 only does a smoke run; the defaults are the 1M-line case the tiled path was built for, which takes the
+// best part of half a minute, so call that one by hand
+void benchOverlaps(int numLines = 1'000'000, int size = 10'000)
+{
+    mt19937 rng(5);
+    uniform_int_distribution<int> coord(0, size - 1);
+    stringlist input;
+    input.reserve(numLines);
+    for (int i = 0; i < numLines; ++i)
+    {
+        int x0 = coord(rng), y0 = coord(rng), x1 = x0, y1 = y0;
+        switch (i % 3)
+        {
+        case 0: x1 = coord(rng); break;
+        case 1: y1 = coord(rng); break;
+        case 2:
+        {
+            const int dx = (rng() & 1) ? 1 : -1;
+            const int dy = (rng() & 1) ? 1 : -1;
+            const int len = min({ coord(rng), dx > 0 ? size - 1 - x0 : x0, dy > 0 ? size - 1 - y0 : y0 });
+            x1 = x0 + dx * len;
+            y1 = y0 + dy * len;
+            break;
+        }
+        }
+        input.push_back(to_string(x0) + "," + to_string(y0) + " -> " + to_string(x1) + "," + to_string(y1));
+    }
+    const auto lines = loadLines(input);
+
+    cout << "day5 " << numLines << " lines on " << size << "x" << size << ":\n";
+    int64_t raster, tiled, tiledAll;
+    {
+        cout << "  ";
+        ScopeTimer timer("raster");
+        raster = countOverlapsRaster(lines, true);
+    }
+    {
+        cout << "  ";
+        ScopeTimer timer("tiled, 1 thread");
+        tiled = countOverlapsTiled(lines, true, 1);
+    }
+    {
+        cout << "  ";
+        ScopeTimer timer("tiled, all threads");
+        tiledAll = countOverlapsTiled(lines, true);
+    }
+    cout << "  " << raster << " / " << tiled << " / " << tiledAll << " overlaps" << endl;
+}
+
+
+int day5(const stringlist& input)
+{
+    return (int)countOverlaps(loadLines(input), false);
+}
+
+int day5_2(const stringlist& input)
+{
+    return (int)countOverlaps(loadLines(input), true);
 }
 
 
@@ -151,8 +584,34 @@ R"(0,9 -> 5,9
 5,5 -> 8,2)";
 
     test(5, day5(READ(sample)));
+    test(5ll, countOverlapsSweep(loadLines(READ(sample)), false));
+    test(5294ll, countOverlapsSweep(loadLines(LOAD(5)), false));
+    test(5294ll, countOverlapsTiled(loadLines(LOAD(5)), false));
     gogogo(day5(LOAD(5)), 5294);
 
     test(12, day5_2(READ(sample)));
+    test(12ll, countOverlapsSweep(loadLines(READ(sample)), true));
+    test(21698ll, countOverlapsSweep(loadLines(LOAD(5)), true));
+    test(21698ll, countOverlapsTiled(loadLines(LOAD(5)), true));
+    test(21698ll, countOverlapsTiled(loadLines(LOAD(5)), true, 4));
+
+    string hugesample =
+R"(0,500000 -> 1000000,500000
+250000,0 -> 250000,1000000
+0,0 -> 1000000,1000000
+1500000,1500000 -> 500000,500000
+2000000,0 -> 0,2000000)";
+    test(500003ll, countOverlaps(loadLines(READ(hugesample)), true));
+
+    string densesample =
+R"(0,0 -> 9999,9999
+9999,0 -> 0,9999
+5000,0 -> 5000,9999
+0,5000 -> 9999,5000
+0,5000 -> 5000,5000)";
+    test(5002ll, countOverlapsTiled(loadLines(READ(densesample)), true));
+    test(5002ll, countOverlapsSweep(loadLines(READ(densesample)), true));
+    nD(benchOverlaps(10'000, 1'000));
+
     gogogo(day5_2(LOAD(5)), 21698);
 }
\ No newline at end of file
@@ -7,25 +7,274 @@ static constexpr int kTimeToFirstSpawn = 2;
 static constexpr int kNumBuckets = kTimeBetweenSpawns + kTimeToFirstSpawn;
 
 
+// a schedule that isn't known until runtime. fish spawn every period days, and newborns wait an extra firstDelay
+struct SpawnSchedule
+{
+    int period = kTimeBetweenSpawns;
+    int firstDelay = kTimeToFirstSpawn;
+
+    int numBuckets() const { return period + firstDelay; }
+};
+
+// a ring buffer of timer buckets: rather than shuffling every bucket down each day, we move where timer 0 lives.
+// the bucket that was timer 0 becomes the newborns' bucket, which conveniently already holds one baby per spawner
+class FishPopulation
+{
+    SpawnSchedule m_schedule;
+    vector<int64_t> m_buckets;
+    int m_zero = 0;
+    int64_t m_total = 0;
+
+public:
+    FishPopulation(const SpawnSchedule& schedule) : m_schedule(schedule)
+    {
+        if (schedule.period < 1 || schedule.firstDelay < 0)
+            throw "spawn schedule needs a period of at least 1 and a non-negative first delay";
+        m_buckets.resize(schedule.numBuckets(), 0);
+    }
+    FishPopulation(const SpawnSchedule& schedule, const string& timers) : FishPopulation(schedule)
+    {
+        for (const string& timer : split(timers, ","))
+            addFish(stoi(timer));
+    }
+
+    void addFish(int timer, int64_t count = 1)
+    {
+        if (timer < 0 || timer >= int(m_buckets.size()))
+            throw "fish timer out of range";
+        if (count > INT64_MAX - m_total)
+            throw "too many fish for an exact count; use day6_mod";
+        m_buckets[(m_zero + timer) % m_buckets.size()] += count;
+        m_total += count;
+    }
+
+    void advance(int numDays = 1)
+    {
+        const int numBuckets = int(m_buckets.size());
+        int resetIx = (m_zero + m_schedule.period - 1) % numBuckets;
+        for (int day = 0; day < numDays; ++day)
+        {
+            int64_t spawners = m_buckets[m_zero];
+            if (spawners > INT64_MAX - m_total)     // no bucket's bigger than the total, so this covers them too
+                throw "too many fish for an exact count; use day6_mod";
+            m_zero = (m_zero + 1 == numBuckets) ? 0 : m_zero + 1;
+            resetIx = (resetIx + 1 == numBuckets) ? 0 : resetIx + 1;
+            m_buckets[resetIx] += spawners;
+            m_total += spawners;
+        }
+    }
+
+    int64_t total() const { return m_total; }
+};
+
+
 int64_t day6(const string& input, int numDays=80)
 {
-    vector<int64_t> buckets(kNumBuckets, 0);
+    FishPopulation fish(SpawnSchedule{}, input);
+    fish.advance(numDays);
 
-    // put the fish in the buckets
-    for (const string& bucket : split(input, ","))
+    return fish.total();
+}
+
+// several species with their own schedules, all living through the same days
+int64_t day6_species(const vector<pair<SpawnSchedule, string>>& species, int numDays)
+{
+    int64_t total = 0;
+    for (auto& [schedule, timers] : species)
+    {
+        FishPopulation fish(schedule, timers);
+        fish.advance(numDays);
+        total += fish.total();
+    }
+    return total;
+}
+
+
+// ---- batch queries ----
+// a fish with timer t after N days is just a fish with timer 0 after N-t days, so one run from a single timer-0 fish
+// out to the longest query answers every query with the same schedule in O(buckets) each
+
+struct FishQuery
+{
+    vector<int64_t> timerCounts;    // how many fish start on each timer
+    int numDays;
+};
+
+vector<int64_t> countFishBatch(const SpawnSchedule& schedule, const vector<FishQuery>& queries)
+{
+    int maxDays = 0;
+    for (const FishQuery& query : queries)
+        maxDays = max(maxDays, query.numDays);
+
+    vector<int64_t> descendants(maxDays + 1);
+    FishPopulation single(schedule);
+    single.addFish(0);
+    descendants[0] = single.total();
+    for (int day = 1; day <= maxDays; ++day)
     {
-        buckets[stoi(bucket)]++;
+        single.advance();
+        descendants[day] = single.total();
     }
 
-    for (int day = 0; day < numDays; ++day)
+    vector<int64_t> results;
+    results.reserve(queries.size());
+    for (const FishQuery& query : queries)
     {
-        int64_t spawners = buckets[0];
-        buckets.erase(buckets.begin());
-        buckets.push_back(spawners);
+        int64_t total = 0;
+        for (int timer = 0; timer < int(query.timerCounts.size()); ++timer)
+        {
+            const int64_t count = query.timerCounts[timer];
+            const int64_t perFish = descendants[max(0, query.numDays - timer)];
+            if (count && perFish > (INT64_MAX - total) / count)
+                throw "too many fish for an exact count; use day6_mod";
+            total += count * perFish;
+        }
+        results.push_back(total);
+    }
+    return results;
+}
+
+
+// ---- matrix version ----
+// one day is a fixed linear map on the buckets, so N days is that map to the power N, which we can get by repeated
+// squaring in O(log N). better still, we only ever want the total, so all we keep is the row vector ones * M^N --
+// weights[i] is how many fish a single fish with timer i turns into after N days
+
+using FishBuckets = array<int64_t, kNumBuckets>;
+using FishMatrix = array<FishBuckets, kNumBuckets>;
+
+// the last day a single timer-0 fish's descendants still fit in an int64. no fish does better than a timer-0 one, so
+// every entry of every power the exact path builds is bounded by this too
+constexpr int64_t fishMaxExactDays()
+{
+    array<uint64_t, kNumBuckets> buckets{ 1 };
+    uint64_t total = 1;
+    for (int64_t day = 0; ; ++day)
+    {
+        const uint64_t spawners = buckets[0];
+        if (total + spawners > uint64_t(INT64_MAX))
+            return day;
+
+        rotate(begin(buckets), begin(buckets) + 1, end(buckets));   // newborns land in the last bucket
         buckets[kTimeBetweenSpawns - 1] += spawners;
+        total += spawners;
+    }
+}
+
+static constexpr int64_t kMaxExactDays = fishMaxExactDays();
+
+// modulus 0 means exact arithmetic, which is only good up to kMaxExactDays
+constexpr FishMatrix fishMul(const FishMatrix& a, const FishMatrix& b, uint64_t modulus = 0)
+{
+    FishMatrix result{};
+    for (int row = 0; row < kNumBuckets; ++row)
+    {
+        for (int k = 0; k < kNumBuckets; ++k)
+        {
+            if (a[row][k] == 0)
+                continue;
+
+            for (int col = 0; col < kNumBuckets; ++col)
+            {
+                uint64_t sum = uint64_t(result[row][col]) + uint64_t(a[row][k]) * uint64_t(b[k][col]);
+                result[row][col] = int64_t(modulus ? sum % modulus : sum);
+            }
+        }
+    }
+    return result;
+}
+
+constexpr FishMatrix fishDayMatrix()
+{
+    FishMatrix m{};
+    for (int bucket = 0; bucket + 1 < kNumBuckets; ++bucket)
+        m[bucket][bucket + 1] = 1;              // everyone's timer ticks down...
+
+    m[kTimeBetweenSpawns - 1][0] += 1;          // ...spawners reset...
+    m[kNumBuckets - 1][0] += 1;                 // ...and each has a baby
+    return m;
+}
+
+constexpr FishBuckets fishWeights(int64_t numDays, uint64_t modulus = 0)
+{
+    // both operands are already reduced, so a modulus below 2^32 keeps each product inside a uint64
+    if (modulus >= (1ull << 32))
+        throw "fish modulus must be below 2^32";
+    if (modulus == 0 && numDays > kMaxExactDays)
+        throw "too many days for an exact fish count; use day6_mod";
+
+    FishMatrix result{};
+    for (int i = 0; i < kNumBuckets; ++i)
+        result[i][i] = 1;
+
+    FishMatrix power = fishDayMatrix();
+    for (; numDays > 0; numDays >>= 1)
+    {
+        if (numDays & 1)
+            result = fishMul(result, power, modulus);
+        if (numDays > 1)
+            power = fishMul(power, power, modulus);     // the square past the top bit is never used, and may not fit
+    }
+
+    FishBuckets weights{};
+    for (int row = 0; row < kNumBuckets; ++row)
+    {
+        for (int col = 0; col < kNumBuckets; ++col)
+        {
+            uint64_t sum = uint64_t(weights[col]) + uint64_t(result[row][col]);
+            weights[col] = int64_t(modulus ? sum % modulus : sum);
+        }
+    }
+    return weights;
+}
+
+// the two questions we actually get asked are answered by the compiler
+static constexpr FishBuckets kWeights80 = fishWeights(80);
+static constexpr FishBuckets kWeights256 = fishWeights(256);
+static_assert(kWeights80[1] + kWeights80[2] + 2 * kWeights80[3] + kWeights80[4] == 5934, "3,4,3,1,2 sample");
+
+FishBuckets loadFishBuckets(const string& input)
+{
+    FishBuckets buckets{};
+    for (const string& bucket : split(input, ","))
+    {
+        int timer = stoi(bucket);
+        if (timer < 0 || timer >= kNumBuckets)
+            throw "fish timer out of range";
+        buckets[timer]++;
     }
+    return buckets;
+}
+
+int64_t day6_matrix(const string& input, int64_t numDays=80)
+{
+    const FishBuckets buckets = loadFishBuckets(input);
+    const FishBuckets weights = (numDays == 80) ? kWeights80 : (numDays == 256) ? kWeights256 : fishWeights(numDays);
 
-    return accumulate(begin(buckets), end(buckets), 0ll);
+    int64_t total = 0;
+    for (int i = 0; i < kNumBuckets; ++i)
+    {
+        if (weights[i] && buckets[i] > (INT64_MAX - total) / weights[i])
+            throw "too many fish for an exact count; use day6_mod";
+        total += buckets[i] * weights[i];
+    }
+    return total;
+}
+
+// population mod some modulus < 2^32, for when numDays is far past the point where the total fits in any int
+int64_t day6_mod(const string& input, int64_t numDays, uint64_t modulus)
+{
+    if (modulus == 0)
+        throw "day6_mod needs a modulus";
+
+    const FishBuckets buckets = loadFishBuckets(input);
+    const FishBuckets weights = fishWeights(numDays, modulus);
+
+    uint64_t total = 0;
+    for (int i = 0; i < kNumBuckets; ++i)
+        total = (total + uint64_t(buckets[i] % modulus) * uint64_t(weights[i])) % modulus;
+
+    return int64_t(total);
 }
 
 
@@ -36,8 +285,47 @@ void run_day6()
 
     test<int64_t>(26, day6(sample, 18));
     test<int64_t>(5934, day6(sample, 80));
+    test<int64_t>(26, day6_matrix(sample, 18));
+    test<int64_t>(5934, day6_matrix(sample, 80));
+    test<int64_t>(361169, day6_matrix(LOADSTR(6), 80));
     gogogo(day6(LOADSTR(6)));
 
     test(26984457539ll, day6(sample, 256));
+    test(26984457539ll, day6_matrix(sample, 256));
+    test(1634946868992ll, day6_matrix(LOADSTR(6), 256));
+    test<int64_t>(984457357, day6_mod(sample, 256, 1000000007));
+    test<int64_t>(29352087, day6_mod(sample, 1000000, 1000000007));
+    test(day6_matrix(sample, 300) % 1000000007, day6_mod(sample, 300, 1000000007));
+    string tooManyDays, tooManyFish;
+    try { day6_matrix(sample, kMaxExactDays + 1); } catch (const char* error) { tooManyDays = error; }
+    try { day6_matrix(sample, kMaxExactDays); } catch (const char* error) { tooManyFish = error; }
+    test(string("too many days for an exact fish count; use day6_mod"), tooManyDays);
+    test(string("too many fish for an exact count; use day6_mod"), tooManyFish);
+    string bigModulus;
+    try { day6_mod(sample, 256, 1ull << 32); } catch (const char* error) { bigModulus = error; }
+    test(string("fish modulus must be below 2^32"), bigModulus);
+
+    test(118ll, day6_species({ { SpawnSchedule{ 3, 1 }, "0,2" } }, 20));
+    test(157ll, day6_species({ { SpawnSchedule{}, sample }, { SpawnSchedule{ 3, 1 }, "0,2" }, { SpawnSchedule{ 5, 5 }, "5" } }, 20));
+
+    vector<FishQuery> queries;
+    for (int numDays : { 18, 80, 256, 0 })
+        queries.push_back({ { 0, 1, 1, 2, 1 }, numDays });
+    auto answers = countFishBatch(SpawnSchedule{}, queries);
+    test(26ll, answers[0]);
+    test(5934ll, answers[1]);
+    test(26984457539ll, answers[2]);
+    test(5ll, answers[3]);
+    string batchTooManyFish;
+    try { countFishBatch(SpawnSchedule{}, { { { 0, 1, 1, 2, 1 }, int(kMaxExactDays) } }); } catch (const char* error) { batchTooManyFish = error; }
+    test(tooManyFish, batchTooManyFish);
+    test(day6_matrix("0", kMaxExactDays), countFishBatch(SpawnSchedule{}, { { { 1 }, int(kMaxExactDays) } })[0]);
+
+    string badTimer, badSchedule;
+    try { day6_species({ { SpawnSchedule{ 3, 1 }, "0,4" } }, 20); } catch (const char* error) { badTimer = error; }
+    try { day6_species({ { SpawnSchedule{ 0, 2 }, "0" } }, 20); } catch (const char* error) { badSchedule = error; }
+    test(string("fish timer out of range"), badTimer);
+    test(string("spawn schedule needs a period of at least 1 and a non-negative first delay"), badSchedule);
+
     gogogo(day6(LOADSTR(6), 256));
 }
\ No newline at end of file
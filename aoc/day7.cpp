@@ -150,14 +150,450 @@ int day7_2_avx(const string& input)
 }
 
 
+// ---- dispatched brute force kernels ----
+// day7_2_avx needs AVX2 on the host and its int16 products overflow once a distance passes 181. these kernels price
+// one position across all the crabs using 32-bit distances and 64-bit products/sums (_mul_epu32 on the even and odd
+// lanes), and the widest one the cpu supports is picked once at startup
+
+using CrabCostFn = int64_t(*)(const int32_t* crabs, size_t numCrabs, int32_t pos);
+
+int64_t crabCostScalar(const int32_t* crabs, size_t numCrabs, int32_t pos)
+{
+    int64_t doubleCost = 0;
+    for (size_t i = 0; i < numCrabs; ++i)
+    {
+        int64_t distance = abs(crabs[i] - pos);
+        doubleCost += distance * (distance + 1);
+    }
+    return doubleCost >> 1;
+}
+
+int64_t crabCostSse41(const int32_t* crabs, size_t numCrabs, int32_t pos)
+{
+    const __m128i pos4 = _mm_set1_epi32(pos);
+    const __m128i one4 = _mm_set1_epi32(1);
+
+    __m128i doubleCost2 = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= numCrabs; i += 4)
+    {
+        __m128i dist4 = _mm_abs_epi32(_mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(crabs + i)), pos4));
+        __m128i distplusone4 = _mm_add_epi32(dist4, one4);
+
+        doubleCost2 = _mm_add_epi64(doubleCost2, _mm_mul_epu32(dist4, distplusone4));
+        doubleCost2 = _mm_add_epi64(doubleCost2, _mm_mul_epu32(_mm_srli_epi64(dist4, 32), _mm_srli_epi64(distplusone4, 32)));
+    }
+
+    int64_t doubleCost = _mm_extract_epi64(doubleCost2, 0) + _mm_extract_epi64(doubleCost2, 1);
+    return (doubleCost >> 1) + crabCostScalar(crabs + i, numCrabs - i, pos);
+}
+
+int64_t crabCostAvx2(const int32_t* crabs, size_t numCrabs, int32_t pos)
+{
+    const __m256i pos8 = _mm256_set1_epi32(pos);
+    const __m256i one8 = _mm256_set1_epi32(1);
+
+    __m256i doubleCost4 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= numCrabs; i += 8)
+    {
+        __m256i dist8 = _mm256_abs_epi32(_mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(crabs + i)), pos8));
+        __m256i distplusone8 = _mm256_add_epi32(dist8, one8);
+
+        doubleCost4 = _mm256_add_epi64(doubleCost4, _mm256_mul_epu32(dist8, distplusone8));
+        doubleCost4 = _mm256_add_epi64(doubleCost4, _mm256_mul_epu32(_mm256_srli_epi64(dist8, 32), _mm256_srli_epi64(distplusone8, 32)));
+    }
+
+    __m128i doubleCost2 = _mm_add_epi64(_mm256_castsi256_si128(doubleCost4), _mm256_extracti128_si256(doubleCost4, 1));
+    int64_t doubleCost = _mm_extract_epi64(doubleCost2, 0) + _mm_extract_epi64(doubleCost2, 1);
+    return (doubleCost >> 1) + crabCostScalar(crabs + i, numCrabs - i, pos);
+}
+
+int64_t crabCostAvx512(const int32_t* crabs, size_t numCrabs, int32_t pos)
+{
+    const __m512i pos16 = _mm512_set1_epi32(pos);
+    const __m512i one16 = _mm512_set1_epi32(1);
+
+    __m512i doubleCost8 = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 16 <= numCrabs; i += 16)
+    {
+        __m512i dist16 = _mm512_abs_epi32(_mm512_sub_epi32(_mm512_loadu_si512(crabs + i), pos16));
+        __m512i distplusone16 = _mm512_add_epi32(dist16, one16);
+
+        doubleCost8 = _mm512_add_epi64(doubleCost8, _mm512_mul_epu32(dist16, distplusone16));
+        doubleCost8 = _mm512_add_epi64(doubleCost8, _mm512_mul_epu32(_mm512_srli_epi64(dist16, 32), _mm512_srli_epi64(distplusone16, 32)));
+    }
+
+    int64_t doubleCost = _mm512_reduce_add_epi64(doubleCost8);
+    return (doubleCost >> 1) + crabCostScalar(crabs + i, numCrabs - i, pos);
+}
+
+// part 1 fuel. no products, but the sum still widens: the even lanes are masked and the odd lanes shifted down into
+// 64-bit accumulators
+
+int64_t crabLinearCostScalar(const int32_t* crabs, size_t numCrabs, int32_t pos)
+{
+    int64_t cost = 0;
+    for (size_t i = 0; i < numCrabs; ++i)
+        cost += abs(crabs[i] - pos);
+    return cost;
+}
+
+int64_t crabLinearCostSse41(const int32_t* crabs, size_t numCrabs, int32_t pos)
+{
+    const __m128i pos4 = _mm_set1_epi32(pos);
+    const __m128i lo4 = _mm_set1_epi64x(0xffffffff);
+
+    __m128i cost2 = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= numCrabs; i += 4)
+    {
+        __m128i dist4 = _mm_abs_epi32(_mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(crabs + i)), pos4));
+        cost2 = _mm_add_epi64(cost2, _mm_and_si128(dist4, lo4));
+        cost2 = _mm_add_epi64(cost2, _mm_srli_epi64(dist4, 32));
+    }
+
+    int64_t cost = _mm_extract_epi64(cost2, 0) + _mm_extract_epi64(cost2, 1);
+    return cost + crabLinearCostScalar(crabs + i, numCrabs - i, pos);
+}
+
+int64_t crabLinearCostAvx2(const int32_t* crabs, size_t numCrabs, int32_t pos)
+{
+    const __m256i pos8 = _mm256_set1_epi32(pos);
+    const __m256i lo8 = _mm256_set1_epi64x(0xffffffff);
+
+    __m256i cost4 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= numCrabs; i += 8)
+    {
+        __m256i dist8 = _mm256_abs_epi32(_mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(crabs + i)), pos8));
+        cost4 = _mm256_add_epi64(cost4, _mm256_and_si256(dist8, lo8));
+        cost4 = _mm256_add_epi64(cost4, _mm256_srli_epi64(dist8, 32));
+    }
+
+    __m128i cost2 = _mm_add_epi64(_mm256_castsi256_si128(cost4), _mm256_extracti128_si256(cost4, 1));
+    int64_t cost = _mm_extract_epi64(cost2, 0) + _mm_extract_epi64(cost2, 1);
+    return cost + crabLinearCostScalar(crabs + i, numCrabs - i, pos);
+}
+
+int64_t crabLinearCostAvx512(const int32_t* crabs, size_t numCrabs, int32_t pos)
+{
+    const __m512i pos16 = _mm512_set1_epi32(pos);
+    const __m512i lo16 = _mm512_set1_epi64(0xffffffff);
+
+    __m512i cost8 = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 16 <= numCrabs; i += 16)
+    {
+        __m512i dist16 = _mm512_abs_epi32(_mm512_sub_epi32(_mm512_loadu_si512(crabs + i), pos16));
+        cost8 = _mm512_add_epi64(cost8, _mm512_and_si512(dist16, lo16));
+        cost8 = _mm512_add_epi64(cost8, _mm512_srli_epi64(dist16, 32));
+    }
+
+    return _mm512_reduce_add_epi64(cost8) + crabLinearCostScalar(crabs + i, numCrabs - i, pos);
+}
+
+
+struct CrabKernel
+{
+    const char* name;
+    CrabCostFn triangular;
+    CrabCostFn linear;
+    bool supported;
+};
+
+// widest last
+static const CrabKernel kCrabKernels[] =
+{
+    { "scalar", crabCostScalar, crabLinearCostScalar, true },
+    { "sse4.1", crabCostSse41, crabLinearCostSse41, cpuFeatures().sse41 },
+    { "avx2", crabCostAvx2, crabLinearCostAvx2, cpuFeatures().avx2 },
+    { "avx512", crabCostAvx512, crabLinearCostAvx512, cpuFeatures().avx512f },
+};
+
+static const CrabKernel& g_crabKernel = *find_if(rbegin(kCrabKernels), rend(kCrabKernels), [](const CrabKernel& k) { return k.supported; });
+
+
+// ---- fast alignment ----
+// brute force is O(range * crabs). but linear cost is minimised at the median, and triangular cost is
+// (sum d^2 + sum |d|) / 2 whose real minimum is always within half a step of the mean -- so we only ever need to
+// price a couple of positions. pricing over a histogram costs O(range) instead of O(crabs), which wins when there
+// are millions of crabs
+
+struct CrabHistogram
+{
+    vector<int64_t> counts;     // counts[pos] = crabs at pos
+    int64_t numCrabs = 0;
+    int64_t sum = 0;
+
+    CrabHistogram(const string& input)
+    {
+        vector<int> crabs;
+        crabs.reserve(input.size() / 2);
+        for (const char* curr = input.c_str(); *curr; )
+        {
+            char* next;
+            long crab = strtol(curr, &next, 10);
+            if (next == curr)
+            {
+                ++curr;     // comma
+                continue;
+            }
+            if (crab < 0)
+                throw "crabs can't be at negative positions";
+            crabs.push_back(int(crab));
+            curr = next;
+        }
+        if (crabs.empty())
+            throw "no crabs";
+
+        counts.resize(size_t(ranges::max(crabs)) + 1, 0);
+        for (int crab : crabs)
+        {
+            ++counts[crab];
+            sum += crab;
+        }
+        numCrabs = int64_t(crabs.size());
+    }
+
+    int maxPos() const { return int(counts.size()) - 1; }
+
+    template<typename CostFn>
+    int64_t costAt(int pos, CostFn&& fuel) const
+    {
+        int64_t cost = 0;
+        for (int crab = 0; crab <= maxPos(); ++crab)
+        {
+            if (counts[crab])
+                cost += counts[crab] * fuel(int64_t(abs(crab - pos)));
+        }
+        return cost;
+    }
+
+    // back to one entry per crab, sorted, for the kernels
+    vector<int32_t> positions() const
+    {
+        vector<int32_t> crabs;
+        crabs.reserve(size_t(numCrabs));
+        for (int crab = 0; crab <= maxPos(); ++crab)
+            crabs.insert(crabs.end(), size_t(counts[crab]), crab);
+        return crabs;
+    }
+};
+
+struct CrabAlignment
+{
+    int position;
+    int64_t cost;
+};
+
+CrabAlignment alignBruteForce(const vector<int32_t>& crabs, CrabCostFn cost)
+{
+    CrabAlignment best{ -1, INT64_MAX };
+    const int32_t maxPos = ranges::max(crabs);
+    for (int32_t pos = 0; pos <= maxPos; ++pos)
+    {
+        int64_t fuel = cost(crabs.data(), crabs.size(), pos);
+        if (fuel < best.cost)
+            best = { pos, fuel };
+    }
+    return best;
+}
+
+// ---- cost policies ----
+// each policy is a fuel function plus the cheapest way we know to find its minimum:
+//   Median       -- sum of |d| is minimised at the median, price one position
+//   NearMean     -- d^2-ish costs have their real minimum within half a step of the mean, price up to four positions
+//   ConvexSearch -- any convex fuel makes the total convex in pos, so binary search on the slope
+//   BruteForce   -- no promises, price every position. linear & triangular fuel go through the dispatched kernels
+//
+// a policy's strategy is only its default: alignCrabs<TriangularCost, AlignStrategy::BruteForce> is the slow but
+// assumption-free answer to check the clever ones against
+
+enum class AlignStrategy { Median, NearMean, ConvexSearch, BruteForce };
+
+struct LinearCost
+{
+    static constexpr AlignStrategy kStrategy = AlignStrategy::Median;
+    int64_t operator()(int64_t distance) const { return distance; }
+};
+
+struct TriangularCost
+{
+    static constexpr AlignStrategy kStrategy = AlignStrategy::NearMean;
+    int64_t operator()(int64_t distance) const { return (distance * (distance + 1)) >> 1; }
+};
+
+struct QuadraticCost
+{
+    static constexpr AlignStrategy kStrategy = AlignStrategy::NearMean;
+    int64_t operator()(int64_t distance) const { return distance * distance; }
+};
+
+// fuel(d) must be convex & non-decreasing in d
+template<typename Fn>
+struct ConvexCost
+{
+    static constexpr AlignStrategy kStrategy = AlignStrategy::ConvexSearch;
+    Fn fuel;
+    int64_t operator()(int64_t distance) const { return fuel(distance); }
+};
+
+template<typename Fn>
+struct AnyCost
+{
+    static constexpr AlignStrategy kStrategy = AlignStrategy::BruteForce;
+    Fn fuel;
+    int64_t operator()(int64_t distance) const { return fuel(distance); }
+};
+
+template<typename Fn> ConvexCost<Fn> convexCost(Fn fuel) { return { fuel }; }
+template<typename Fn> AnyCost<Fn> anyCost(Fn fuel) { return { fuel }; }
+
+
+template<typename Cost, AlignStrategy Strategy = Cost::kStrategy>
+CrabAlignment alignCrabs(const CrabHistogram& hist, const Cost& cost = {})
+{
+    CrabAlignment best{ -1, INT64_MAX };
+    auto tryPos = [&](int pos)
+    {
+        int64_t fuel = hist.costAt(pos, cost);
+        if (fuel < best.cost)
+            best = { pos, fuel };
+    };
+
+    if constexpr (Strategy == AlignStrategy::Median)
+    {
+        // lower median: the first position with at least half the crabs at or before it
+        int64_t seen = 0;
+        int median = 0;
+        for (; median < hist.maxPos(); ++median)
+        {
+            seen += hist.counts[median];
+            if (2 * seen >= hist.numCrabs)
+                break;
+        }
+        tryPos(median);
+    }
+    else if constexpr (Strategy == AlignStrategy::NearMean)
+    {
+        const int64_t floorMean = hist.sum / hist.numCrabs;
+        for (int64_t pos = max<int64_t>(0, floorMean - 1); pos <= min<int64_t>(hist.maxPos(), floorMean + 2); ++pos)
+            tryPos(int(pos));
+    }
+    else if constexpr (Strategy == AlignStrategy::ConvexSearch)
+    {
+        // first pos where stepping right stops helping
+        int lo = 0, hi = hist.maxPos();
+        while (lo < hi)
+        {
+            int mid = lo + (hi - lo) / 2;
+            if (hist.costAt(mid + 1, cost) >= hist.costAt(mid, cost))
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        tryPos(lo);
+    }
+    else if constexpr (is_same_v<Cost, LinearCost> || is_same_v<Cost, TriangularCost>)
+    {
+        best = alignBruteForce(hist.positions(), is_same_v<Cost, LinearCost> ? g_crabKernel.linear : g_crabKernel.triangular);
+    }
+    else
+    {
+        for (int pos = 0; pos <= hist.maxPos(); ++pos)
+            tryPos(pos);
+    }
+
+    return best;
+}
+
+int day7_fast(const string& input)
+{
+    return (int)alignCrabs<LinearCost>(CrabHistogram(input)).cost;
+}
+
+int64_t day7_2_fast(const string& input)
+{
+    return alignCrabs<TriangularCost>(CrabHistogram(input)).cost;
+}
+
+
+vector<int32_t> loadCrabs(const string& input)
+{
+    auto splits = split(input, ",");
+    vector<int32_t> crabs;
+    crabs.reserve(splits.size());
+    ranges::transform(splits, back_inserter(crabs), [](const string& s) { return stoi(s); });
+    return crabs;
+}
+
+CrabAlignment alignTriangularBruteForce(const vector<int32_t>& crabs, CrabCostFn cost = g_crabKernel.triangular)
+{
+    return alignBruteForce(crabs, cost);
+}
+
+int64_t day7_2_simd(const string& input)
+{
+    return alignTriangularBruteForce(loadCrabs(input)).cost;
+}
+
+void benchCrabKernels(const string& input)
+{
+    auto crabs = loadCrabs(input);
+    cout << "day7 kernels (picked " << g_crabKernel.name << "):\n";
+    for (const CrabKernel& kernel : kCrabKernels)
+    {
+        if (!kernel.supported)
+        {
+            cout << "  " << kernel.name << " not supported\n";
+            continue;
+        }
+
+        cout << "  ";
+        ScopeTimer timer(kernel.name);
+        alignTriangularBruteForce(crabs, kernel.triangular);
+    }
+}
+
+
 void run_day7()
 {
     string sample = R"(16,1,2,0,4,2,7,1,2,14)";
 
     test(37, day7(sample));
-    gogogo(day7(LOADSTR(7)));
-
-    test(168, day7_2_avx(sample));
+    test(37, day7_fast(sample));
+    test(2, alignCrabs<LinearCost>(CrabHistogram(sample)).position);
+    test(37ll, alignCrabs(CrabHistogram(sample), anyCost([](int64_t d) { return d; })).cost);
+    test(2, alignCrabs<LinearCost, AlignStrategy::BruteForce>(CrabHistogram(sample)).position);
+    test(339321ll, alignCrabs<LinearCost, AlignStrategy::BruteForce>(CrabHistogram(LOADSTR(7))).cost);
+    test(339321, day7(LOADSTR(7)));
+    gogogo(day7_fast(LOADSTR(7)), 339321);
+
+    if (cpuFeatures().avx2)
+        test(168, day7_2_avx(sample));
+    test(168ll, day7_2_fast(sample));
+    test(5, alignCrabs<TriangularCost>(CrabHistogram(sample)).position);
+    test(168ll, alignCrabs(CrabHistogram(sample), convexCost([](int64_t d) { return (d * (d + 1)) >> 1; })).cost);
+    test(5, alignCrabs<QuadraticCost>(CrabHistogram(sample)).position);
+    test(291ll, alignCrabs<QuadraticCost>(CrabHistogram(sample)).cost);
+    test(3ll, alignCrabs(CrabHistogram(sample), anyCost([](int64_t d) { return int64_t(d >= 3); })).cost);
+    if (cpuFeatures().avx2)
+        test(95476244, day7_2_avx(LOADSTR(7)));
+    test(168ll, day7_2_simd(sample));
+    test(5, alignCrabs<TriangularCost, AlignStrategy::BruteForce>(CrabHistogram(sample)).position);
+    test(95476244ll, alignCrabs<TriangularCost, AlignStrategy::BruteForce>(CrabHistogram(LOADSTR(7))).cost);
+    for (const CrabKernel& kernel : kCrabKernels)
+    {
+        if (kernel.supported)
+        {
+            test(339321ll, alignBruteForce(loadCrabs(LOADSTR(7)), kernel.linear).cost);
+            test(95476244ll, alignTriangularBruteForce(loadCrabs(LOADSTR(7)), kernel.triangular).cost);
+        }
+    }
+    test(int64_t(8) * 30000 * 30001 / 2, alignTriangularBruteForce({ 0, 0, 0, 0, 60000, 60000, 60000, 60000, 30000 }).cost);
+    nD(benchCrabKernels(LOADSTR(7)));
     //gogogo(day7_2_original(LOADSTR(7)), 95476244);
-    gogogo(day7_2_avx(LOADSTR(7)), 95476244);
+    gogogo<int64_t>(day7_2_fast(LOADSTR(7)), 95476244);
 }
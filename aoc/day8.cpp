@@ -1,6 +1,8 @@
 #include "pch.h"
 #include "harness.h"
+#include <bit>
 #include <ranges>
+#include <thread>
 
 static const int kSegCount = 7;
 
@@ -133,18 +135,149 @@ int descramble(const string& line)
     return display;
 }
 
+// ---- bitmask decoder ----
+// with each pattern as a 7-bit mask of its segments we don't need to work out the wiring at all. 1, 4, 7 and 8 have
+// unique segment counts, and every other digit is pinned down by how much of the 1 and the 4 it contains:
+//   5 segments: 3 contains all of 1, 5 shares 3 segments with 4, 2 shares only 2
+//   6 segments: 9 contains all of 4, 0 contains all of 1 (but not 4), 6 contains neither
+
+constexpr int digitFromMask(uint8_t mask, uint8_t one, uint8_t four)
+{
+    switch (popcount(mask))
+    {
+    case 2: return 1;
+    case 3: return 7;
+    case 4: return 4;
+    case 7: return 8;
+    case 5:
+        if ((mask & one) == one)
+            return 3;
+        return (popcount(uint8_t(mask & four)) == 3) ? 5 : 2;
+    case 6:
+        if ((mask & four) == four)
+            return 9;
+        return ((mask & one) == one) ? 0 : 6;
+    }
+    throw "no digit lights up that few segments";
+}
+
+int decodeDisplay(string_view line)
+{
+    const char* curr = line.data();
+    const char* end = curr + line.size();
+
+    // the signal patterns only need to tell us which masks are 1 and 4
+    uint8_t one = 0, four = 0;
+    uint8_t mask = 0;
+    auto notePattern = [&]()
+    {
+        int numSegs = popcount(mask);
+        if (numSegs == 2)
+            one = mask;
+        else if (numSegs == 4)
+            four = mask;
+        mask = 0;
+    };
+    for (; curr != end && *curr != '|'; ++curr)
+    {
+        if (*curr >= 'a' && *curr <= 'g')
+            mask |= uint8_t(1 << (*curr - 'a'));
+        else if (mask)
+            notePattern();
+    }
+    if (mask)
+        notePattern();
+    if (!one || !four)
+        throw "patterns need a 1 and a 4 to decode anything";
+
+    int display = 0;
+    mask = 0;
+    for (; curr != end; ++curr)
+    {
+        if (*curr >= 'a' && *curr <= 'g')
+        {
+            mask |= uint8_t(1 << (*curr - 'a'));
+        }
+        else if (mask)
+        {
+            display = display * 10 + digitFromMask(mask, one, four);
+            mask = 0;
+        }
+    }
+    if (mask)
+        display = display * 10 + digitFromMask(mask, one, four);
+
+    return display;
+}
+
 int day8_2(const stringlist& input)
 {
     int total = 0;
     for (auto& line : input)
     {
-        total += descramble(line);
+        total += decodeDisplay(line);
     }
 
     return total;
 }
 
 
+// ---- batch decode ----
+// every line decodes independently, so a big dump of notes is cut into one run of whole lines per thread
+
+struct DisplayBatch
+{
+    int64_t total = 0;
+    vector<int> values;     // only filled in if asked for, in line order
+};
+
+DisplayBatch decodeNotes(string_view notes, bool keepValues = false, unsigned numThreads = thread::hardware_concurrency())
+{
+    numThreads = max(numThreads, 1u);
+
+    // chunk boundaries, each nudged forward to just after a newline
+    vector<size_t> bounds(numThreads + 1, notes.size());
+    bounds[0] = 0;
+    for (unsigned i = 1; i < numThreads; ++i)
+    {
+        size_t pos = max(bounds[i - 1], notes.size() * i / numThreads);
+        size_t eol = notes.find('\n', pos);
+        bounds[i] = (eol == string_view::npos) ? notes.size() : eol + 1;
+    }
+
+    vector<DisplayBatch> partials(numThreads);
+    auto decodeChunk = [&](unsigned chunk)
+    {
+        DisplayBatch& partial = partials[chunk];
+        string_view text = notes.substr(bounds[chunk], bounds[chunk + 1] - bounds[chunk]);
+        while (!text.empty())
+        {
+            size_t eol = text.find('\n');
+            string_view line = text.substr(0, eol);
+            text.remove_prefix((eol == string_view::npos) ? text.size() : eol + 1);
+
+            if (line.find('|') == string_view::npos)
+                continue;
+
+            int value = decodeDisplay(line);
+            partial.total += value;
+            if (keepValues)
+                partial.values.push_back(value);
+        }
+    };
+
+    parallelFor(numThreads, decodeChunk);
+
+    DisplayBatch result;
+    for (DisplayBatch& partial : partials)
+    {
+        result.total += partial.total;
+        result.values.insert(result.values.end(), partial.values.begin(), partial.values.end());
+    }
+    return result;
+}
+
+
 void run_day8()
 {
     string sample =
@@ -163,5 +296,20 @@ gcafb gcf dcaebfg ecagb gf abcdeg gaef cafbge fdbac fegbdc | fgae cfgab fg bagce
     gogogo(day8(LOAD(8)));
 
     test(5353, descramble("acedgfb cdfbe gcdfa fbcad dab cefabd cdfgeb eafb cagedb ab | cdfeb fcadb cdfeb cdbaf"));
-    gogogo(day8_2(LOAD(8)));
+    test(5353, decodeDisplay("acedgfb cdfbe gcdfa fbcad dab cefabd cdfgeb eafb cagedb ab | cdfeb fcadb cdfeb cdbaf"));
+    test(5353, decodeDisplay("acedgfb\tcdfbe gcdfa fbcad dab cefabd cdfgeb eafb cagedb ab|cdfeb fcadb cdfeb cdbaf\r"));
+    string badDigit;
+    try { decodeDisplay("acedgfb cdfbe gcdfa fbcad dab cefabd cdfgeb eafb cagedb ab | cdfeb f cdfeb cdbaf"); } catch (const char* error) { badDigit = error; }
+    test(string("no digit lights up that few segments"), badDigit);
+    test(61229, day8_2(READ(sample)));
+    test(61229ll, decodeNotes(sample, false, 3).total);
+    auto sampleBatch = decodeNotes(sample, true, 4);
+    test(size_t(10), sampleBatch.values.size());
+    test(8394, sampleBatch.values[0]);
+    test(9361, sampleBatch.values[3]);
+
+    auto fullBatch = decodeNotes(LOADSTR(8), true);
+    test(1011785ll, fullBatch.total);
+    test(size_t(200), fullBatch.values.size());
+    gogogo(day8_2(LOAD(8)), 1011785);
 }
\ No newline at end of file
@@ -1,6 +1,10 @@
 #include "pch.h"
 #include "harness.h"
 
+#include <bit>
+#include <immintrin.h>
+#include <thread>
+
 
 int day9(const stringlist& input)
 {
@@ -30,9 +34,155 @@ int day9(const stringlist& input)
 }
 
 
+// ---- simd low points ----
+// the heightmap gets a border of cells higher than any real height on all four sides, so every cell has four
+// neighbours and there are no edge checks. then a row of 32 cells is compared against the same 32 shifted left,
+// right, up and down in one go
+
+class PaddedHeightmap
+{
+    vector<uint8_t> m_cells;
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_stride;
+
+public:
+    static constexpr uint8_t kBorder = '9' + 1;
+
+    PaddedHeightmap(const stringlist& input)
+    {
+        m_width = (uint32_t)input.front().length();
+        m_height = (uint32_t)input.size();
+
+        // a left border cell, whole 32-wide blocks, and room for the last block's right neighbours
+        m_stride = getBlocksPerRow() * 32 + 32;
+        m_cells.assign(size_t(m_stride) * (m_height + 2), kBorder);
+
+        for (uint32_t y = 0; y < m_height; ++y)
+            ranges::copy(input[y], m_cells.begin() + (y + 1) * m_stride + 1);
+    }
+
+    uint32_t getWidth() const { return m_width; }
+    uint32_t getHeight() const { return m_height; }
+    uint32_t getStride() const { return m_stride; }
+    uint32_t getBlocksPerRow() const { return (m_width + 31) / 32; }
+
+    // first real cell of row y
+    const uint8_t* row(uint32_t y) const { return m_cells.data() + size_t(y + 1) * m_stride + 1; }
+};
+
+struct LowPoints
+{
+    vector<uint32_t> masks;     // a bit per cell, getBlocksPerRow() words per row
+    uint32_t blocksPerRow = 0;
+    int64_t risk = 0;
+    int64_t count = 0;
+
+    bool isLow(uint32_t x, uint32_t y) const { return (masks[y * blocksPerRow + x / 32] >> (x % 32)) & 1; }
+};
+
+// rows [y0, y1) of the low point masks, plus their risk and count
+void findLowPointsScalar(const PaddedHeightmap& map, LowPoints& low, uint32_t y0, uint32_t y1, int64_t* risk, int64_t* count)
+{
+    const ptrdiff_t stride = map.getStride();
+
+    int64_t riskSum = 0;
+    int64_t numLow = 0;
+    for (uint32_t y = y0; y < y1; ++y)
+    {
+        const uint8_t* cells = map.row(y);
+        uint32_t* masks = low.masks.data() + size_t(y) * low.blocksPerRow;
+        for (uint32_t x = 0; x < map.getWidth(); ++x)
+        {
+            const uint8_t* cell = cells + x;
+            if (cell[-1] > *cell && cell[1] > *cell && cell[-stride] > *cell && cell[stride] > *cell)
+            {
+                masks[x / 32] |= 1u << (x % 32);
+                riskSum += *cell - '0' + 1;
+                ++numLow;
+            }
+        }
+    }
+
+    *risk = riskSum;
+    *count = numLow;
+}
+
+void findLowPointsAvx2(const PaddedHeightmap& map, LowPoints& low, uint32_t y0, uint32_t y1, int64_t* risk, int64_t* count)
+{
+    const __m256i riskOffset = _mm256_set1_epi8('0' - 1);     // risk = height + 1
+    const __m256i zero = _mm256_setzero_si256();
+    const ptrdiff_t stride = map.getStride();
+
+    __m256i riskSum = zero;
+    int64_t numLow = 0;
+    for (uint32_t y = y0; y < y1; ++y)
+    {
+        const uint8_t* cells = map.row(y);
+        uint32_t* masks = low.masks.data() + size_t(y) * low.blocksPerRow;
+        for (uint32_t block = 0; block < low.blocksPerRow; ++block, cells += 32)
+        {
+            __m256i centre = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cells));
+            __m256i left = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cells - 1));
+            __m256i right = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cells + 1));
+            __m256i up = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cells - stride));
+            __m256i down = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cells + stride));
+
+            // heights are all small positive chars, so the signed compare is fine
+            __m256i isLow = _mm256_and_si256(
+                _mm256_and_si256(_mm256_cmpgt_epi8(left, centre), _mm256_cmpgt_epi8(right, centre)),
+                _mm256_and_si256(_mm256_cmpgt_epi8(up, centre), _mm256_cmpgt_epi8(down, centre)));
+
+            uint32_t mask = uint32_t(_mm256_movemask_epi8(isLow));
+            masks[block] = mask;
+            numLow += popcount(mask);
+
+            __m256i lowRisk = _mm256_and_si256(isLow, _mm256_sub_epi8(centre, riskOffset));
+            riskSum = _mm256_add_epi64(riskSum, _mm256_sad_epu8(lowRisk, zero));
+        }
+    }
+
+    alignas(32) int64_t sums[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(sums), riskSum);
+    *risk = sums[0] + sums[1] + sums[2] + sums[3];
+    *count = numLow;
+}
+
+LowPoints findLowPoints(const PaddedHeightmap& map, unsigned numThreads = thread::hardware_concurrency())
+{
+    LowPoints low;
+    low.blocksPerRow = map.getBlocksPerRow();
+    low.masks.assign(size_t(low.blocksPerRow) * map.getHeight(), 0);
+
+    // one horizontal band of rows per thread
+    const auto findInRows = cpuFeatures().avx2 ? findLowPointsAvx2 : findLowPointsScalar;
+
+    numThreads = clamp(numThreads, 1u, max(map.getHeight(), 1u));
+    vector<int64_t> risks(numThreads, 0), counts(numThreads, 0);
+    parallelFor(numThreads, [&](unsigned band)
+    {
+        uint32_t y0 = uint32_t(uint64_t(map.getHeight()) * band / numThreads);
+        uint32_t y1 = uint32_t(uint64_t(map.getHeight()) * (band + 1) / numThreads);
+        findInRows(map, low, y0, y1, &risks[band], &counts[band]);
+    });
+
+    low.risk = accumulate(begin(risks), end(risks), 0ll);
+    low.count = accumulate(begin(counts), end(counts), 0ll);
+    return low;
+}
+
+int day9_simd(const stringlist& input)
+{
+    return (int)findLowPoints(PaddedHeightmap(input)).risk;
+}
+
+
 class MapD9
 {
+public:
     using Cell = int8_t;
+
+private:
     vector<Cell> m_cells;
 
     uint32_t m_width;
@@ -53,6 +203,7 @@ public:
 
     uint32_t getWidth() const { return m_width; }
     uint32_t getHeight() const { return m_height; }
+    const Cell* data() const { return m_cells.data(); }
 
     int findBasinSize(int x, int y) const;
 
@@ -129,13 +280,196 @@ vector<int> MapD9::getBasinSizes() const
 }
 
 
+// ---- connected component labelling ----
+// every cell that isn't a 9 belongs to exactly one basin, so the basins are just the connected components of
+// non-9 cells. one scanline pass hands out provisional labels from the left & up neighbours and unions them where
+// they meet, then a second pass resolves each cell to its root and counts -- O(cells) no matter how many basins
+//
+// to spread that over threads the map is cut into horizontal strips which are labelled independently. each strip's
+// labels get an offset so they're unique across the map, then a seam pass unions the labels that touch across each
+// strip border, and finally every cell is mapped to its global root
+
+class BasinLabeller
+{
+    vector<uint32_t> m_labels;      // per cell, 0 for walls
+    vector<uint32_t> m_parent;      // union-find over the global labels
+
+    static uint32_t findRoot(vector<uint32_t>& parent, uint32_t label)
+    {
+        while (parent[label] != label)
+        {
+            parent[label] = parent[parent[label]];
+            label = parent[label];
+        }
+        return label;
+    }
+
+    struct Strip
+    {
+        uint32_t y0, y1;
+        uint32_t firstLabel;        // global label of this strip's local label 1
+        vector<int> sizes;          // by local label
+    };
+
+    void labelStrip(const MapD9& map, Strip& strip);
+
+public:
+    vector<int> getBasinSizes(const MapD9& map, unsigned numThreads = thread::hardware_concurrency());
+
+    const vector<uint32_t>& getLabels() const { return m_labels; }
+};
+
+// leaves the strip's cells holding compact local labels 1..n, and their sizes in strip.sizes[1..n]
+void BasinLabeller::labelStrip(const MapD9& map, Strip& strip)
+{
+    const uint32_t width = map.getWidth();
+    vector<uint32_t> parent(1, 0);
+
+    const MapD9::Cell* cell = map.data() + size_t(strip.y0) * width;
+    uint32_t* label = m_labels.data() + size_t(strip.y0) * width;
+    for (uint32_t y = strip.y0; y < strip.y1; ++y)
+    {
+        for (uint32_t x = 0; x < width; ++x, ++cell, ++label)
+        {
+            if (*cell == '9')
+            {
+                *label = 0;
+                continue;
+            }
+
+            uint32_t up = (y > strip.y0) ? *(label - width) : 0;
+            uint32_t left = (x > 0) ? *(label - 1) : 0;
+            if (up && left)
+            {
+                uint32_t upRoot = findRoot(parent, up);
+                uint32_t leftRoot = findRoot(parent, left);
+                auto [root, child] = minmax(upRoot, leftRoot);
+                parent[child] = root;
+                *label = root;
+            }
+            else if (up || left)
+            {
+                *label = up | left;
+            }
+            else
+            {
+                *label = uint32_t(parent.size());
+                parent.push_back(*label);
+            }
+        }
+    }
+
+    // roots always have the smallest label in their set, so a single forward pass can number them compactly
+    vector<uint32_t> compact(parent.size(), 0);
+    uint32_t numLabels = 0;
+    for (uint32_t l = 1; l < parent.size(); ++l)
+    {
+        uint32_t root = findRoot(parent, l);
+        compact[l] = (root == l) ? ++numLabels : compact[root];
+    }
+
+    strip.sizes.assign(numLabels + 1, 0);
+    for (uint32_t* l = m_labels.data() + size_t(strip.y0) * width; l != label; ++l)
+    {
+        if (*l)
+        {
+            *l = compact[*l];
+            ++strip.sizes[*l];
+        }
+    }
+}
+
+vector<int> BasinLabeller::getBasinSizes(const MapD9& map, unsigned numThreads)
+{
+    const uint32_t width = map.getWidth();
+    const uint32_t height = map.getHeight();
+    m_labels.resize(size_t(width) * height);
+
+    numThreads = clamp(numThreads, 1u, max(height, 1u));
+    vector<Strip> strips(numThreads);
+    for (unsigned i = 0; i < numThreads; ++i)
+    {
+        strips[i].y0 = uint32_t(uint64_t(height) * i / numThreads);
+        strips[i].y1 = uint32_t(uint64_t(height) * (i + 1) / numThreads);
+    }
+
+    auto forEachStrip = [&](auto&& fn)
+    {
+        parallelFor(numThreads, [&](unsigned i) { fn(strips[i]); });
+    };
+
+    forEachStrip([&](Strip& strip) { labelStrip(map, strip); });
+
+    uint32_t numLabels = 0;
+    for (Strip& strip : strips)
+    {
+        strip.firstLabel = numLabels + 1;
+        numLabels += uint32_t(strip.sizes.size()) - 1;
+    }
+
+    // stitch the strips together along each seam
+    m_parent.resize(numLabels + 1);
+    iota(begin(m_parent), end(m_parent), 0);
+    for (unsigned i = 1; i < numThreads; ++i)
+    {
+        const Strip& above = strips[i - 1];
+        const Strip& below = strips[i];
+        if (above.y1 == above.y0 || below.y1 == below.y0)
+            continue;
+
+        const uint32_t* upRow = m_labels.data() + size_t(below.y0 - 1) * width;
+        const uint32_t* downRow = upRow + width;
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            if (upRow[x] && downRow[x])
+            {
+                uint32_t upRoot = findRoot(m_parent, above.firstLabel - 1 + upRow[x]);
+                uint32_t downRoot = findRoot(m_parent, below.firstLabel - 1 + downRow[x]);
+                auto [root, child] = minmax(upRoot, downRoot);
+                m_parent[child] = root;
+            }
+        }
+    }
+
+    // flatten so that every label points straight at its root, then total up the sizes
+    vector<int> sizeByRoot(numLabels + 1, 0);
+    for (uint32_t l = 1; l <= numLabels; ++l)
+        m_parent[l] = m_parent[m_parent[l]];
+    for (const Strip& strip : strips)
+    {
+        for (uint32_t l = 1; l < strip.sizes.size(); ++l)
+            sizeByRoot[m_parent[strip.firstLabel - 1 + l]] += strip.sizes[l];
+    }
+
+    forEachStrip([&](Strip& strip)
+        {
+            uint32_t* end = m_labels.data() + size_t(strip.y1) * width;
+            for (uint32_t* l = m_labels.data() + size_t(strip.y0) * width; l != end; ++l)
+            {
+                if (*l)
+                    *l = m_parent[strip.firstLabel - 1 + *l];
+            }
+        });
+
+    vector<int> basinSizes;
+    ranges::copy_if(sizeByRoot, back_inserter(basinSizes), [](int size) { return size > 0; });
+    return basinSizes;
+}
+
+
+// a small map can have fewer than three basins, in which case it's the product of however many there are
+int productOfBiggestThree(vector<int> basinSizes)
+{
+    const auto endBiggest = begin(basinSizes) + min<ptrdiff_t>(3, ssize(basinSizes));
+    ranges::partial_sort(begin(basinSizes), endBiggest, end(basinSizes), greater{});
+    return accumulate(begin(basinSizes), endBiggest, 1, [](int acc, int size) { return acc * size; });
+}
+
 int day9_2(const stringlist& input)
 {
     MapD9 map(input);
-    auto basinSizes = map.getBasinSizes();
-    ranges::nth_element(basinSizes, begin(basinSizes) + 2, greater{});
-    auto result = accumulate(begin(basinSizes), begin(basinSizes) + 3, 1, [](int acc, int size) { return acc * size; });
-    return result;
+    BasinLabeller labeller;
+    return productOfBiggestThree(labeller.getBasinSizes(map));
 }
 
 
@@ -149,8 +483,17 @@ R"(2199943210
 9899965678)";
 
     test(15, day9(READ(sample)));
-    gogogo(day9(LOAD(9)));
+    test(15, day9_simd(READ(sample)));
+    test(4ll, findLowPoints(PaddedHeightmap(READ(sample)), 3).count);
+    test(true, findLowPoints(PaddedHeightmap(READ(sample))).isLow(9, 0));
+    test(506, day9(LOAD(9)));
+    gogogo(day9_simd(LOAD(9)), 506);
 
     test(1134, day9_2(READ(sample)));
-    gogogo(day9_2(LOAD(9)));
+    test(1134, productOfBiggestThree(MapD9(READ(sample)).getBasinSizes()));
+    test(8, productOfBiggestThree({ 2, 4 }));
+    test(931200, productOfBiggestThree(MapD9(LOAD(9)).getBasinSizes()));
+    test(1134, productOfBiggestThree(BasinLabeller().getBasinSizes(MapD9(READ(sample)), 5)));
+    test(931200, productOfBiggestThree(BasinLabeller().getBasinSizes(MapD9(LOAD(9)), 7)));
+    gogogo(day9_2(LOAD(9)), 931200);
 }
\ No newline at end of file
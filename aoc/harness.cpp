@@ -77,6 +77,46 @@ void jumptoday(int day)
 }
 
 
+// -------------------------------------------------------------------
+
+
+#include <intrin.h>
+
+static CpuFeatures detectCpuFeatures()
+{
+    CpuFeatures cpu;
+
+    int regs[4];    // eax, ebx, ecx, edx
+    __cpuid(regs, 0);
+    const int maxLeaf = regs[0];
+
+    __cpuid(regs, 1);
+    cpu.sse41 = (regs[2] & (1 << 19)) != 0;
+    const bool osxsave = (regs[2] & (1 << 27)) != 0;
+    const bool avx = (regs[2] & (1 << 28)) != 0;
+
+    // the os has to be saving the ymm (and for avx512, the zmm/opmask) state across context switches too
+    const uint64_t xcr0 = osxsave ? _xgetbv(0) : 0;
+    const bool osYmm = (xcr0 & 0x06) == 0x06;
+    const bool osZmm = (xcr0 & 0xe6) == 0xe6;
+
+    if (maxLeaf >= 7)
+    {
+        __cpuidex(regs, 7, 0);
+        cpu.avx2 = avx && osYmm && (regs[1] & (1 << 5)) != 0;
+        cpu.avx512f = cpu.avx2 && osZmm && (regs[1] & (1 << 16)) != 0;
+    }
+
+    return cpu;
+}
+
+const CpuFeatures& cpuFeatures()
+{
+    static const CpuFeatures cpu = detectCpuFeatures();     // local static so other files' static init can use it
+    return cpu;
+}
+
+
 // -------------------------------------------------------------------
 
 const WORD kwhite = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY;
@@ -1,11 +1,14 @@
 #pragma once
 
 #include <chrono>
+#include <exception>
 #include <fstream>
 #include <iostream>
 #include <list>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <Windows.h>
 #include <wincon.h>
@@ -276,6 +279,54 @@ public:
 #define TIME_SCOPE(name)    ScopeTimer timer_##name(#name)
 
 
+// ----- cpu features -----
+// the x64 builds only assume sse2, so anything wider has to check here before using it
+struct CpuFeatures
+{
+    bool sse41 = false;
+    bool avx2 = false;
+    bool avx512f = false;
+};
+
+const CpuFeatures& cpuFeatures();
+
+
+// ----- threading -----
+// fn(band) for every band in [0, numBands): band 0 runs on the calling thread, the rest get a thread each. a throw
+// can't leave a thread, so each band's is held until everyone's joined and then the first one is rethrown
+template<typename Fn>
+void parallelFor(unsigned numBands, Fn&& fn)
+{
+    vector<exception_ptr> errors(numBands);
+    auto runBand = [&](unsigned band)
+    {
+        try
+        {
+            fn(band);
+        }
+        catch (...)
+        {
+            errors[band] = current_exception();
+        }
+    };
+
+    vector<thread> threads;
+    for (unsigned band = 1; band < numBands; ++band)
+        threads.push_back(thread(runBand, band));
+    if (numBands > 0)
+        runBand(0);
+
+    for (auto& thr : threads)
+        thr.join();
+
+    for (const exception_ptr& error : errors)
+    {
+        if (error)
+            rethrow_exception(error);
+    }
+}
+
+
 // ----- day harness -----
 extern int gday;
 extern int gpart;